@@ -0,0 +1,98 @@
+#include "aot.h"
+#include <string.h>
+#include <vector>
+#include "hash.h"
+
+/// Every program registered by a generated file
+/// A function local so it exists before the static initialisers of generated files run.
+static std::vector<aot::program> &registry()
+{
+    static std::vector<aot::program> programs;
+    return programs;
+}
+
+bool aot::add(const program &translated)
+{
+    registry().push_back(translated);
+    return true;
+}
+
+const aot::program *aot::find(const unsigned char *rom, const size_t size)
+{
+    const std::vector<program> &programs = registry();
+    if (programs.empty())
+    {
+        return nullptr;
+    }
+
+    const uint64_t hash = fnv1a(rom, size);
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        if (programs[i].hash == hash && programs[i].size == size)
+        {
+            return &programs[i];
+        }
+    }
+    return nullptr;
+}
+
+aot::aot(const program &translated)
+    : _program(&translated)
+{
+    memset(_blocks, 0, sizeof(_blocks));
+    memset(_covered, 0, sizeof(_covered));
+
+    for (size_t i = 0; i < translated.count; ++i)
+    {
+        const block &entry = translated.blocks[i];
+        _blocks[entry.address & 0x0FFF] = &entry;
+        for (unsigned int address = entry.address; address < (unsigned int)entry.address + entry.size && address < 4096; ++address)
+        {
+            _covered[address] = true;
+        }
+    }
+}
+
+int aot::run(chip8 &machine, const uint64_t budget) const
+{
+    const block *entry = _blocks[machine._programCounter & 0x0FFF];
+    if (entry == nullptr || entry->length > budget)
+    {
+        return 0;
+    }
+
+    entry->run(machine);
+    return entry->length;
+}
+
+void aot::invalidate(const unsigned short address)
+{
+    const unsigned short wrapped = address & 0x0FFF;
+    if (!_covered[wrapped])
+    {
+        return;
+    }
+
+    // Self-modifying code is rare, so finding the blocks the hard way is fine
+    for (size_t i = 0; i < _program->count; ++i)
+    {
+        const block &entry = _program->blocks[i];
+        if (wrapped >= entry.address && wrapped < (unsigned int)entry.address + entry.size)
+        {
+            _blocks[entry.address] = nullptr;
+        }
+    }
+    _covered[wrapped] = false;
+}
+
+void aot::interpret(chip8 &machine, const unsigned short address)
+{
+    machine._programCounter = address & 0x0FFF;
+
+    // A copy, FX33 and FX55 can write over their own opcode and decode the cached record again while it runs
+    // Addresses outside program space have no record and are decoded from memory, like cycle() does
+    const unsigned short pc = machine._programCounter;
+    const chip8::instruction ins = pc >= 0x200 && (pc & 1) == 0 ? machine._decodeCache[(pc - 0x200) >> 1]
+                                                                : machine.decode(machine._memory[pc] << 8 | machine._memory[(pc + 1) & 0x0FFF]);
+    (machine.*ins.execute)(ins);
+}
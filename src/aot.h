@@ -0,0 +1,109 @@
+/// ROMs translated to C++ ahead of time
+/// The translate tool turns a ROM into a C++ file with one function per basic block, which is
+/// compiled and linked into the emulator like any other source file. The file registers its
+/// program here, and a chip8 that loads the same ROM with AOT dispatch calls those functions
+/// instead of interpreting.
+///
+/// A block only runs while every byte it was translated from is unchanged, a program writing over
+/// its own code gets the blocks it touched dropped and that code is interpreted from then on.
+/// Whatever the translator could not follow, BNNN jumps and code only reached through them, is
+/// interpreted too.
+///
+/// Blocks spell out the register, jump, call and skip opcodes and hand the rest (drawing, timers,
+/// keys, memory and the shifts that depend on the quirks) to the interpreter's own handlers, so
+/// translated and interpreted runs give the same results.
+///
+#ifndef AOT_H
+#define AOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+class aot
+{
+public:
+    /// A translated basic block, runs all of its instructions and leaves the program counter at the next one
+    typedef void (*function)(chip8 &machine);
+
+    struct block
+    {
+        unsigned short address;
+
+        /// Bytes translated, starting at address
+        unsigned short size;
+
+        /// Instructions the block runs
+        unsigned short length;
+
+        function run;
+    };
+
+    struct program
+    {
+        const char *name;
+
+        /// fnv1a() of the ROM the blocks were translated from, and its size
+        uint64_t hash;
+        size_t size;
+
+        const block *blocks;
+        size_t count;
+    };
+
+    /// Make a translated program available to every machine, generated files call this from a static initialiser
+    static bool add(const program &translated);
+
+    /// The translated program for a ROM, or nullptr if there is none
+    static const program *find(const unsigned char *rom, const size_t size);
+
+    explicit aot(const program &translated);
+
+    /// Run the translated block at the program counter of the machine, unless it is longer than budget instructions
+    /// Returns the number of Chip 8 instructions executed, or 0 if the instruction at the program counter must be interpreted
+    int run(chip8 &machine, const uint64_t budget) const;
+
+    /// Called for every byte a program writes to memory
+    /// Every block translated from the byte is dropped for good
+    void invalidate(const unsigned short address);
+
+    /// Machine state for generated code, inline so blocks compile down to plain loads and stores
+    static unsigned char *v(chip8 &machine)
+    {
+        return machine._v;
+    }
+
+    static unsigned short &indexRegister(chip8 &machine)
+    {
+        return machine._indexRegister;
+    }
+
+    static unsigned short &programCounter(chip8 &machine)
+    {
+        return machine._programCounter;
+    }
+
+    static unsigned short *stack(chip8 &machine)
+    {
+        return machine._stack;
+    }
+
+    static unsigned short &stackPointer(chip8 &machine)
+    {
+        return machine._stackPointer;
+    }
+
+    /// Run the instruction at an address through the interpreter, from the decode cache when it is in program space
+    static void interpret(chip8 &machine, const unsigned short address);
+
+private:
+    const program *_program;
+
+    /// Block starting at every address, or nullptr if there is none
+    const block *_blocks[4096];
+
+    /// Set for every byte of Chip 8 memory that some runnable block was translated from
+    bool _covered[4096];
+};
+
+#endif
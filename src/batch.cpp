@@ -0,0 +1,341 @@
+/// Headless batch runner
+/// Runs every ROM in a directory tree (or listed in a manifest) for a fixed number of 60hz frames
+/// on all cores, without a display, and reports a fingerprint of where each one ended up.
+/// With -c a job also stops at the end of the frame in which it has run that many instructions.
+///
+/// Usage: batch <rom directory | manifest> [-f frames] [-c instructions] [-r instructions per second] [-s seed] [-j threads] [-d switch|cache|jit|threaded|aot] [-q vip|schip|modern] [-o results] [-w wav directory] [-v video directory]
+///
+/// A manifest is a text file with one job per line: <rom path> [frames] [input log]
+/// Jobs with an input log replay it, using the seed recorded in the log.
+/// Blank lines and lines starting with # are ignored.
+///
+/// Results are written tab separated, one line per job in input order:
+/// rom, state hash, screen hash, frames run, instructions executed, wall time in milliseconds, bad opcode
+/// The last column is the opcode a ROM halted on, see chip8::halted(), or - if it never hit one.
+///
+/// With -w every job also renders its buzzer to <wav directory>/<job number>-<rom name>.wav,
+/// as fast as it runs rather than in real time. With -v it records its screen to
+/// <video directory>/<job number>-<rom name>.c8fs, which framegif turns into a GIF.
+///
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <inttypes.h>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "buzzer.h"
+#include "chip8.h"
+#include "framestream.h"
+#include "inputlog.h"
+#include "random.h"
+#include "threadpool.h"
+#include "wavwriter.h"
+
+const uint64_t DEFAULT_FRAMES = 3600;
+
+const char *USAGE = "Usage: batch <rom directory | manifest> [-f frames] [-c instructions] [-r instructions per second] [-s seed] [-j threads] [-d switch|cache|jit|threaded|aot] [-q vip|schip|modern] [-o results] [-w wav directory] [-v video directory]\n";
+
+#ifdef CHIP8_PROFILE
+/// Profile of every job together, reported once all jobs have finished
+profiler totalProfile;
+std::mutex totalProfileMutex;
+
+const char *HEATMAP_PATH = "batch-heatmap.pgm";
+#endif
+
+struct job
+{
+    std::string rom;
+    uint64_t frames;
+    std::string inputs;
+    std::string wav;
+    std::string video;
+
+    bool loaded;
+    uint64_t framesRun;
+    uint64_t stateHash;
+    uint64_t gfxHash;
+    uint64_t instructions;
+    double milliseconds;
+    bool halted;
+    unsigned short badOpcode;
+};
+
+bool readManifest(const char *path, const uint64_t frames, std::vector<job> &jobs)
+{
+    std::ifstream manifest(path);
+    if (!manifest)
+    {
+        fprintf(stderr, "Could not open manifest %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream fields(line);
+        job entry = job();
+        if (!(fields >> entry.rom) || entry.rom[0] == '#')
+        {
+            continue;
+        }
+        if (!(fields >> entry.frames))
+        {
+            entry.frames = frames;
+        }
+        fields >> entry.inputs;
+        jobs.push_back(entry);
+    }
+    return true;
+}
+
+void readDirectory(const char *path, const uint64_t frames, std::vector<job> &jobs)
+{
+    for (const std::filesystem::directory_entry &file : std::filesystem::recursive_directory_iterator(path))
+    {
+        if (file.is_regular_file())
+        {
+            job entry = job();
+            entry.rom = file.path().string();
+            entry.frames = frames;
+            jobs.push_back(entry);
+        }
+    }
+}
+
+/// Where a job writes its audio or video, creating the directory if need be
+std::string outputPath(const char *directory, const size_t index, const std::string &rom, const char *extension)
+{
+    std::filesystem::create_directories(directory);
+    char number[16];
+    snprintf(number, sizeof(number), "%04zu-", index);
+    return (std::filesystem::path(directory) / (number + std::filesystem::path(rom).stem().string() + extension)).string();
+}
+
+void run(job &entry, const chip8::dispatch mode, const quirks preset, const unsigned int rate, const uint64_t seed, const uint64_t budget)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<chip8> machine(new chip8());
+    machine->init();
+    machine->setDispatch(mode);
+    machine->setQuirks(preset);
+    machine->setInstructionRate(rate);
+    machine->seed(seed);
+    entry.loaded = machine->load(entry.rom.c_str());
+
+    inputLog inputs;
+    if (!entry.inputs.empty())
+    {
+        entry.loaded = entry.loaded && inputs.load(entry.inputs.c_str());
+        inputs.rewind(*machine);
+    }
+
+    // Audio is only made when asked for, a machine without a sound log doesn't record anything
+    std::vector<chip8::soundEvent> sounds;
+    std::vector<int16_t> samples;
+    buzzer synth;
+    wavWriter wav;
+    if (entry.loaded && !entry.wav.empty())
+    {
+        machine->setSoundLog(&sounds);
+        entry.loaded = wav.open(entry.wav.c_str(), synth.sampleRate());
+    }
+
+    frameRecorder video;
+    if (entry.loaded && !entry.video.empty())
+    {
+        entry.loaded = video.open(entry.video.c_str());
+    }
+
+    if (entry.loaded)
+    {
+        // Key changes land between frames, a log recorded interactively is stamped the same way
+        uint64_t frame = 0;
+        for (; frame < entry.frames && (budget == 0 || machine->instructions() < budget); ++frame)
+        {
+            inputs.replay(*machine);
+            const uint64_t first = machine->instructions();
+            machine->runFrame();
+
+            if (!entry.wav.empty())
+            {
+                synth.renderFrame(sounds, first, machine->instructions(), samples);
+                wav.write(samples.data(), samples.size());
+                sounds.clear();
+                samples.clear();
+            }
+
+            // Stamped with the frames run so far, the blank screen at frame 0 is left out
+            if (!entry.video.empty() && machine->drawFlag())
+            {
+                video.record(machine->gfx(), frame + 1);
+                machine->setDrawFlag(false);
+            }
+        }
+        entry.loaded = wav.close() && video.close(frame);
+        entry.framesRun = frame;
+
+        entry.stateHash = machine->stateHash();
+        entry.gfxHash = machine->gfxHash();
+        entry.instructions = machine->instructions();
+        entry.halted = machine->halted();
+        entry.badOpcode = machine->badOpcode();
+
+#ifdef CHIP8_PROFILE
+        std::lock_guard<std::mutex> lock(totalProfileMutex);
+        totalProfile.merge(machine->profile());
+#endif
+    }
+
+    entry.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    uint64_t frames = DEFAULT_FRAMES;
+    uint64_t budget = 0;
+    unsigned int rate = DEFAULT_INSTRUCTION_RATE;
+    uint64_t seed = DEFAULT_SEED;
+    unsigned int threads = 0;
+    chip8::dispatch mode = chip8::dispatch::DECODE_CACHE;
+    quirks preset = quirks::MODERN;
+    const char *output = nullptr;
+    const char *wavDirectory = nullptr;
+    const char *videoDirectory = nullptr;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+        {
+            frames = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            budget = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            rate = strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            seed = strtoull(argv[i + 1], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            threads = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            if (!parseDispatch(argv[i + 1], mode))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            if (!parseQuirks(argv[i + 1], preset))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            output = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            wavDirectory = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+        {
+            videoDirectory = argv[i + 1];
+        }
+    }
+
+    std::vector<job> jobs;
+    if (std::filesystem::is_directory(argv[1]))
+    {
+        readDirectory(argv[1], frames, jobs);
+    }
+    else if (!readManifest(argv[1], frames, jobs))
+    {
+        return 1;
+    }
+
+    // Numbered so ROMs with the same name in different directories don't overwrite each other
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (wavDirectory != nullptr)
+        {
+            jobs[i].wav = outputPath(wavDirectory, i, jobs[i].rom, ".wav");
+        }
+        if (videoDirectory != nullptr)
+        {
+            jobs[i].video = outputPath(videoDirectory, i, jobs[i].rom, ".c8fs");
+        }
+    }
+
+    {
+        threadPool pool(threads);
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            job *entry = &jobs[i];
+            pool.submit([entry, mode, preset, rate, seed, budget]
+                        { run(*entry, mode, preset, rate, seed, budget); });
+        }
+        pool.wait();
+    }
+
+    FILE *results = output != nullptr ? fopen(output, "w") : stdout;
+    if (results == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", output);
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const job &entry = jobs[i];
+        if (!entry.loaded)
+        {
+            fprintf(results, "%s\tLOAD FAILED\n", entry.rom.c_str());
+            ++failed;
+            continue;
+        }
+        char badOpcode[8] = "-";
+        if (entry.halted)
+        {
+            snprintf(badOpcode, sizeof(badOpcode), "%04X", entry.badOpcode);
+        }
+        fprintf(results, "%s\t%016" PRIx64 "\t%016" PRIx64 "\t%" PRIu64 "\t%" PRIu64 "\t%.3f\t%s\n",
+                entry.rom.c_str(), entry.stateHash, entry.gfxHash, entry.framesRun, entry.instructions, entry.milliseconds, badOpcode);
+    }
+
+    if (results != stdout)
+    {
+        fclose(results);
+    }
+
+#ifdef CHIP8_PROFILE
+    totalProfile.report(stderr);
+    totalProfile.writeHeatmap(HEATMAP_PATH);
+#endif
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,354 @@
+/// Benchmark runner
+/// Measures how fast the core runs a set of generated micro-ROMs, each hammering one class of opcodes,
+/// and optionally real ROM files, so changes to the interpreter can be compared run against run.
+///
+/// Usage: bench [rom ...] [-t seconds] [-r instructions per second] [-d switch|cache|jit|threaded|aot] [-k] [-o results.json]
+///
+/// Every program runs whole 60hz frames (see chip8::runFrame()) for at least the given wall time.
+/// A ROM blocked in FX0A runs no instructions. With -k a key is pressed whenever one is waited for,
+/// a different one each time, otherwise the ROM is reported as stalled.
+/// A table is printed to stderr, and with -o the results are also written as JSON:
+/// {"dispatch": ..., "rate": ..., "benchmarks": [{"name": ..., "instructions": ..., "frames": ...,
+///  "seconds": ..., "instructionsPerSecond": ..., "nsPerInstruction": ..., "framesPerSecond": ...,
+///  "keysPressed": ..., "stalled": ...}, ...]}
+/// nsPerInstruction is null for a program that ran no instructions.
+///
+#include <chrono>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+const double DEFAULT_SECONDS = 1.0;
+
+const char *USAGE = "Usage: bench [rom ...] [-t seconds] [-r instructions per second] [-d switch|cache|jit|threaded|aot] [-k] [-o results.json]\n";
+
+/// Frames run between looks at the clock
+const int FRAMES_PER_CHECK = 64;
+
+struct benchmark
+{
+    std::string name;
+
+    /// Generated program, empty when the program is read from the file called name
+    std::vector<unsigned char> program;
+
+    bool loaded;
+    uint64_t instructions;
+    uint64_t frames;
+    double seconds;
+
+    /// Keys pressed to get the program past FX0A, and whether it ran no instructions at all
+    uint64_t keysPressed;
+    bool stalled;
+};
+
+/// Assemble a program from opcodes, stored big endian like a ROM file
+std::vector<unsigned char> assemble(const std::vector<unsigned short> &opcodes)
+{
+    std::vector<unsigned char> program;
+    for (size_t i = 0; i < opcodes.size(); ++i)
+    {
+        program.push_back(opcodes[i] >> 8);
+        program.push_back(opcodes[i] & 0xFF);
+    }
+    return program;
+}
+
+/// 8XY4/8XY5 chains between a handful of registers, closed by a jump back to the start
+std::vector<unsigned char> aluProgram()
+{
+    std::vector<unsigned short> opcodes = {0x6013, 0x6137, 0x6259, 0x637B};
+    for (int i = 0; i < 32; ++i)
+    {
+        opcodes.push_back(0x8014);
+        opcodes.push_back(0x8125);
+        opcodes.push_back(0x8234);
+        opcodes.push_back(0x8305);
+    }
+    opcodes.push_back(0x1208);
+    return assemble(opcodes);
+}
+
+/// Counting loops made of 3XNN/4XNN skips and 1NNN jumps
+std::vector<unsigned char> branchProgram()
+{
+    return assemble({
+        0x6000, // 200: V0 = 0
+        0x7001, // 202: V0 += 1
+        0x4080, // 204: skip unless V0 == 0x80
+        0x1200, // 206: restart the count
+        0x3001, // 208: skip if V0 == 1 (never here)
+        0x4100, // 20A: skip if V1 != 0 (never)
+        0x3100, // 20C: skip if V1 == 0 (always)
+        0x1200, // 20E: not reached
+        0x1202, // 210: next count
+    });
+}
+
+/// A character drawn across the screen, moving a column each time
+std::vector<unsigned char> spriteProgram()
+{
+    return assemble({
+        0x6000, // 200: V0 = 0, x
+        0x6100, // 202: V1 = 0, y
+        0x6208, // 204: V2 = 8, the character
+        0xF229, // 206: I = character V2
+        0xD015, // 208: draw
+        0x7001, // 20A: x += 1
+        0x7103, // 20C: y += 3
+        0xD015, // 20E: draw
+        0x1208, // 210: again
+    });
+}
+
+/// BCD conversion and register dumps and loads through I
+std::vector<unsigned char> memoryProgram()
+{
+    return assemble({
+        0xA300, // 200: I = 0x300
+        0x7017, // 202: V0 += 0x17
+        0xF033, // 204: BCD of V0
+        0xFF55, // 206: store V0-VF
+        0xFF65, // 208: load V0-VF
+        0xF233, // 20A: BCD of V2
+        0xF765, // 20C: load V0-V7
+        0x1202, // 20E: again
+    });
+}
+
+/// Nested subroutine calls and returns
+std::vector<unsigned char> callProgram()
+{
+    return assemble({
+        0x2206, // 200: call 206
+        0x220C, // 202: call 20C
+        0x1200, // 204: again
+        0x7001, // 206: V0 += 1
+        0x220C, // 208: call 20C
+        0x00EE, // 20A: return
+        0x7101, // 20C: V1 += 1
+        0x00EE, // 20E: return
+    });
+}
+
+/// Press the next key if the machine waits for one, counting the presses in entry
+void answerKey(chip8 &machine, benchmark &entry)
+{
+    if (machine.waitingForKey())
+    {
+        const unsigned char key = entry.keysPressed & 0xF;
+        machine.setKey(key, true);
+        machine.setKey(key, false);
+        ++entry.keysPressed;
+    }
+}
+
+void run(benchmark &entry, const chip8::dispatch mode, const unsigned int rate, const double seconds, const bool pressKeys)
+{
+    std::unique_ptr<chip8> machine(new chip8());
+    machine->init();
+    machine->setDispatch(mode);
+    machine->setInstructionRate(rate);
+    entry.loaded = entry.program.empty() ? machine->load(entry.name.c_str()) : machine->load(entry.program.data(), entry.program.size());
+    if (!entry.loaded)
+    {
+        return;
+    }
+
+    // Warm up caches and the JIT before the clock starts
+    for (int i = 0; i < FRAMES_PER_CHECK; ++i)
+    {
+        if (pressKeys)
+        {
+            answerKey(*machine, entry);
+        }
+        machine->runFrame();
+    }
+
+    const uint64_t firstInstruction = machine->instructions();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point now;
+    entry.frames = 0;
+    do
+    {
+        for (int i = 0; i < FRAMES_PER_CHECK; ++i)
+        {
+            if (pressKeys)
+            {
+                answerKey(*machine, entry);
+            }
+            machine->runFrame();
+        }
+        entry.frames += FRAMES_PER_CHECK;
+        now = std::chrono::steady_clock::now();
+    } while (std::chrono::duration<double>(now - start).count() < seconds);
+
+    entry.instructions = machine->instructions() - firstInstruction;
+    entry.seconds = std::chrono::duration<double>(now - start).count();
+    entry.stalled = entry.instructions == 0;
+}
+
+/// Write a string as a JSON string literal
+void writeString(FILE *file, const std::string &text)
+{
+    fputc('"', file);
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        const unsigned char c = text[i];
+        if (c == '"' || c == '\\')
+        {
+            fprintf(file, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(file, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+bool writeJson(const char *path, const char *mode, const unsigned int rate, const std::vector<benchmark> &benchmarks)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\"dispatch\": \"%s\", \"rate\": %u, \"benchmarks\": [", mode, rate);
+    bool first = true;
+    for (size_t i = 0; i < benchmarks.size(); ++i)
+    {
+        const benchmark &entry = benchmarks[i];
+        if (!entry.loaded)
+        {
+            continue;
+        }
+
+        fputs(first ? "\n  {\"name\": " : ",\n  {\"name\": ", file);
+        first = false;
+        writeString(file, entry.name);
+        fprintf(file, ", \"instructions\": %" PRIu64 ", \"frames\": %" PRIu64 ", \"seconds\": %.6f", entry.instructions, entry.frames, entry.seconds);
+        fprintf(file, ", \"instructionsPerSecond\": %.0f", entry.instructions / entry.seconds);
+        if (entry.stalled)
+        {
+            fputs(", \"nsPerInstruction\": null", file);
+        }
+        else
+        {
+            fprintf(file, ", \"nsPerInstruction\": %.3f", entry.seconds * 1e9 / entry.instructions);
+        }
+        fprintf(file, ", \"framesPerSecond\": %.1f, \"keysPressed\": %" PRIu64 ", \"stalled\": %s}",
+                entry.frames / entry.seconds, entry.keysPressed, entry.stalled ? "true" : "false");
+    }
+    fputs("\n]}\n", file);
+
+    const bool written = ferror(file) == 0;
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+    return written;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = DEFAULT_SECONDS;
+    unsigned int rate = DEFAULT_INSTRUCTION_RATE;
+    chip8::dispatch mode = chip8::dispatch::DECODE_CACHE;
+    const char *modeName = "cache";
+    const char *output = nullptr;
+    bool pressKeys = false;
+
+    std::vector<benchmark> benchmarks = {
+        {"alu", aluProgram(), false, 0, 0, 0.0, 0, false},
+        {"branch", branchProgram(), false, 0, 0, 0.0, 0, false},
+        {"sprite", spriteProgram(), false, 0, 0, 0.0, 0, false},
+        {"memory", memoryProgram(), false, 0, 0, 0.0, 0, false},
+        {"call", callProgram(), false, 0, 0, 0.0, 0, false},
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+        {
+            benchmark entry = benchmark();
+            entry.name = argv[i];
+            benchmarks.push_back(entry);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-k") == 0)
+        {
+            pressKeys = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            fputs(USAGE, stderr);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            seconds = atof(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            rate = strtoul(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            if (!parseDispatch(argv[i + 1], mode))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+            modeName = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            output = argv[i + 1];
+        }
+        ++i;
+    }
+
+    // One at a time, so benchmarks don't compete for cores or caches
+    fprintf(stderr, "%-24s %14s %10s %12s\n", "program", "instructions/s", "ns/instr", "frames/s");
+    int failed = 0;
+    for (size_t i = 0; i < benchmarks.size(); ++i)
+    {
+        benchmark &entry = benchmarks[i];
+        run(entry, mode, rate, seconds, pressKeys);
+        if (!entry.loaded)
+        {
+            fprintf(stderr, "%-24s LOAD FAILED\n", entry.name.c_str());
+            ++failed;
+            continue;
+        }
+        if (entry.stalled)
+        {
+            fprintf(stderr, "%-24s STALLED, no instructions ran%s\n", entry.name.c_str(), pressKeys ? "" : " (waiting for a key? try -k)");
+            continue;
+        }
+        fprintf(stderr, "%-24s %14.0f %10.3f %12.1f\n", entry.name.c_str(),
+                entry.instructions / entry.seconds, entry.seconds * 1e9 / entry.instructions, entry.frames / entry.seconds);
+    }
+
+    if (output != nullptr && !writeJson(output, modeName, rate, benchmarks))
+    {
+        return 1;
+    }
+
+    return failed == 0 ? 0 : 1;
+}
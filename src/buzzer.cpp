@@ -0,0 +1,102 @@
+#include "buzzer.h"
+
+namespace
+{
+    /// Time the tone takes to fade fully in or out
+    const double FADE_SECONDS = 0.002;
+
+    /// Correction for a unit step at phase t of a wave advancing dt per sample
+    /// Smooths the sample either side of the step into a two sample polynomial instead.
+    inline double polyBlep(double t, const double dt)
+    {
+        if (t < dt)
+        {
+            t /= dt;
+            return t + t - t * t - 1.0;
+        }
+        if (t > 1.0 - dt)
+        {
+            t = (t - 1.0) / dt;
+            return t * t + t + t + 1.0;
+        }
+        return 0.0;
+    }
+}
+
+buzzer::buzzer(const unsigned int sampleRate, const double frequency, const double volume)
+    : _sampleRate(sampleRate > 0 ? sampleRate : DEFAULT_SAMPLE_RATE), _phase(0.0), _volume(volume), _on(false), _gain(0.0), _frameRemainder(0)
+{
+    _step = frequency / _sampleRate;
+    _fade = 1.0 / (FADE_SECONDS * _sampleRate);
+}
+
+unsigned int buzzer::sampleRate() const
+{
+    return _sampleRate;
+}
+
+/// Next sample of the square wave from -1 to 1, with the gain applied
+double buzzer::nextSample()
+{
+    // Fade towards the buzzer's state
+    if (_on && _gain < 1.0)
+    {
+        _gain = _gain + _fade < 1.0 ? _gain + _fade : 1.0;
+    }
+    else if (!_on && _gain > 0.0)
+    {
+        _gain = _gain - _fade > 0.0 ? _gain - _fade : 0.0;
+    }
+
+    // Keep the oscillator running through silence, it costs little and keeps the phase continuous
+    double half = _phase + 0.5;
+    if (half >= 1.0)
+    {
+        half -= 1.0;
+    }
+    double value = _phase < 0.5 ? 1.0 : -1.0;
+    value += polyBlep(_phase, _step);
+    value -= polyBlep(half, _step);
+
+    _phase += _step;
+    if (_phase >= 1.0)
+    {
+        _phase -= 1.0;
+    }
+
+    return value * _gain;
+}
+
+void buzzer::renderFrame(const std::vector<chip8::soundEvent> &events, const uint64_t first, const uint64_t last, std::vector<int16_t> &samples)
+{
+    // 44100 / 60 is a whole number, other rates spread the remainder over the frames of a second
+    const unsigned int count = (_frameRemainder + _sampleRate) / 60;
+    _frameRemainder = (_frameRemainder + _sampleRate) % 60;
+
+    const uint64_t span = last > first ? last - first : 1;
+    size_t next = 0;
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        // Apply every change up to this sample, the timer tick ending the frame lands on the next one
+        while (next < events.size())
+        {
+            const uint64_t instruction = events[next].instruction;
+            const uint64_t offset = instruction > first ? instruction - first : 0;
+            if (offset * count / span > i)
+            {
+                break;
+            }
+            _on = events[next].on;
+            ++next;
+        }
+
+        samples.push_back((int16_t)(nextSample() * _volume * 32767.0));
+    }
+
+    // Whatever is left happened at the very end of the frame
+    for (; next < events.size(); ++next)
+    {
+        _on = events[next].on;
+    }
+}
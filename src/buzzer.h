@@ -0,0 +1,57 @@
+/// Square wave synthesizer for the Chip 8 buzzer
+/// The machine only logs when its buzzer turns on and off, see chip8::setSoundLog(). Once a frame
+/// has run, renderFrame() turns the frame's log into a 60th of a second of samples, placing every
+/// change where it happened within the frame by its instruction count.
+///
+/// The tone is a PolyBLEP square wave, so its edges don't alias into a buzz of their own at low
+/// sample rates, and it fades in and out over a couple of milliseconds instead of clicking.
+///
+/// Samples are signed 16-bit mono. A host playing them live hands them to its audio thread
+/// through a sampleQueue.
+///
+#ifndef BUZZER_H
+#define BUZZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "chip8.h"
+#include "spscring.h"
+
+const unsigned int DEFAULT_SAMPLE_RATE = 44100;
+
+/// About 180ms at the default sample rate, enough to ride out a late frame
+typedef spscRing<int16_t, 8192> sampleQueue;
+
+class buzzer
+{
+public:
+    buzzer(const unsigned int sampleRate = DEFAULT_SAMPLE_RATE, const double frequency = 440.0, const double volume = 0.25);
+
+    /// Append one frame of samples
+    /// events is the machine's sound log for the frame, which ran instructions first up to last.
+    void renderFrame(const std::vector<chip8::soundEvent> &events, const uint64_t first, const uint64_t last, std::vector<int16_t> &samples);
+
+    unsigned int sampleRate() const;
+
+private:
+    double nextSample();
+
+    unsigned int _sampleRate;
+
+    /// Oscillator phase in cycles from 0 to 1 and how far it moves per sample
+    double _phase;
+    double _step;
+
+    double _volume;
+
+    /// Whether the buzzer is on, and the current gain as it fades towards that
+    bool _on;
+    double _gain;
+    double _fade;
+
+    /// Sample rates that aren't a multiple of 60 alternate frame lengths, this carries the remainder
+    unsigned int _frameRemainder;
+};
+
+#endif
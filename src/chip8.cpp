@@ -1,7 +1,19 @@
 #include "chip8.h"
+#include "aot.h"
+#include "hash.h"
+#include "jit.h"
+#include "random.h"
+#include <chrono>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <thread>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 unsigned char chip8_fontset[80] =
     {
@@ -24,6 +36,169 @@ unsigned char chip8_fontset[80] =
 };
 
 const unsigned short PROGRAM_START_ADDRESS = 512;
+const unsigned short MEMORY_SIZE = 4096;
+
+/// Instructions a fork runs on the decode cache before it builds a JIT code cache of its own, see fork()
+const uint64_t FORK_JIT_WARMUP = 10000;
+
+/// Rotate a row of the screen right, pixels pushed off the right edge wrap around to the left
+static inline uint64_t rotateRight(const uint64_t row, const unsigned int shift)
+{
+    return (row >> shift) | (row << ((64 - shift) & 63));
+}
+
+// Labels as values are a GCC and Clang extension, elsewhere THREADED falls through to the decode cache in cycle()
+#if defined(__GNUC__) && !defined(CHIP8_PROFILE)
+#define CHIP8_THREADED
+#endif
+
+/// Every handler as a small number, in the order of the labels in chip8::runThreaded()
+enum opcodeIndex : unsigned char
+{
+    OP_BAD,
+    OP_00E0,
+    OP_00EE,
+    OP_1NNN,
+    OP_2NNN,
+    OP_3XNN,
+    OP_4XNN,
+    OP_5XY0,
+    OP_6XNN,
+    OP_7XNN,
+    OP_8XY0,
+    OP_8XY1,
+    OP_8XY2,
+    OP_8XY3,
+    OP_8XY4,
+    OP_8XY5,
+    OP_8XY6,
+    OP_8XY7,
+    OP_8XYE,
+    OP_9XY0,
+    OP_ANNN,
+    OP_BNNN,
+    OP_CXNN,
+    OP_DXYN,
+    OP_EX9E,
+    OP_EXA1,
+    OP_FX07,
+    OP_FX0A,
+    OP_FX15,
+    OP_FX18,
+    OP_FX1E,
+    OP_FX29,
+    OP_FX33,
+    OP_FX55,
+    OP_FX65,
+    OPCODE_COUNT
+};
+
+/// The handler chip8::decode() picks for an opcode, as an opcodeIndex
+constexpr unsigned char indexOf(const unsigned short opcode)
+{
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        return (opcode & 0x000F) == 0x0 ? OP_00E0 : (opcode & 0x000F) == 0xE ? OP_00EE : OP_BAD;
+    case 0x1:
+        return OP_1NNN;
+    case 0x2:
+        return OP_2NNN;
+    case 0x3:
+        return OP_3XNN;
+    case 0x4:
+        return OP_4XNN;
+    case 0x5:
+        return OP_5XY0;
+    case 0x6:
+        return OP_6XNN;
+    case 0x7:
+        return OP_7XNN;
+    case 0x8:
+        return (opcode & 0x000F) <= 0x7 ? OP_8XY0 + (opcode & 0x000F) : (opcode & 0x000F) == 0xE ? OP_8XYE : OP_BAD;
+    case 0x9:
+        return OP_9XY0;
+    case 0xA:
+        return OP_ANNN;
+    case 0xB:
+        return OP_BNNN;
+    case 0xC:
+        return OP_CXNN;
+    case 0xD:
+        return OP_DXYN;
+    case 0xE:
+        return (opcode & 0x00FF) == 0x9E ? OP_EX9E : (opcode & 0x00FF) == 0xA1 ? OP_EXA1 : OP_BAD;
+    default:
+        switch (opcode & 0x00FF)
+        {
+        case 0x07:
+            return OP_FX07;
+        case 0x0A:
+            return OP_FX0A;
+        case 0x15:
+            return OP_FX15;
+        case 0x18:
+            return OP_FX18;
+        case 0x1E:
+            return OP_FX1E;
+        case 0x29:
+            return OP_FX29;
+        case 0x33:
+            return OP_FX33;
+        case 0x55:
+            return OP_FX55;
+        case 0x65:
+            return OP_FX65;
+        }
+        return OP_BAD;
+    }
+}
+
+/// Handler of every one of the 65536 opcodes, built by the compiler
+/// One byte per opcode keeps the table at 64KB, a table of handler addresses would be eight times that.
+struct opcodeTable
+{
+    unsigned char index[65536];
+
+    constexpr opcodeTable()
+        : index()
+    {
+        // The handler only depends on the first nibble and the last byte, so decode each of those
+        // pairs once and copy it to all 16 values of X, which keeps within compile time step limits
+        for (unsigned int group = 0; group < 16; ++group)
+        {
+            for (unsigned int low = 0; low < 256; ++low)
+            {
+                const unsigned char handler = indexOf(group << 12 | low);
+                for (unsigned int x = 0; x < 16; ++x)
+                {
+                    index[group << 12 | x << 8 | low] = handler;
+                }
+            }
+        }
+    }
+};
+
+constexpr opcodeTable OPCODES;
+
+chip8::chip8()
+    : chip8(std::make_shared<memoryPage>(), std::make_shared<decodedPage>())
+{
+}
+
+/// A machine starting out on pages it may share with others, see fork()
+chip8::chip8(const std::shared_ptr<memoryPage> &memory, const std::shared_ptr<decodedPage> &decoded)
+    : _memoryPage(memory), _soundLog(nullptr), _input(nullptr), _inputTime(0), _instructions(0), _frames(0), _instructionRate(DEFAULT_INSTRUCTION_RATE), _frameStart(0), _frame(0), _dispatch(dispatch::DECODE_CACHE),
+      _quirks(quirks::MODERN), _decoder(&chip8::decodeWith<modernQuirks>), _threaded(&chip8::runThreaded<modernQuirks>), _decodedPage(decoded), _jitFrom(0)
+{
+    _memory = _memoryPage->bytes;
+    _decodeCache = _decodedPage->records;
+    _superinstructions = _decodedPage->fused;
+}
+
+chip8::~chip8()
+{
+}
 
 /// Initialize registers and memory
 void chip8::init()
@@ -31,14 +206,16 @@ void chip8::init()
     // Reset opcode
     _opcode = 0;
 
-    // Clear memory
-    for (int i = 0; i < sizeof(_memory) / sizeof(unsigned char); ++i)
+    // Clear memory, and with it any program translated ahead of time
+    _aot.reset();
+    ownMemory();
+    for (int i = 0; i < MEMORY_SIZE; ++i)
     {
         _memory[i] = 0;
     }
 
     // Clear registers
-    for (int i = 0; i < sizeof(_v) / sizeof(unsigned char); ++i)
+    for (unsigned int i = 0; i < sizeof(_v) / sizeof(unsigned char); ++i)
     {
         _v[i] = 0;
     }
@@ -51,7 +228,7 @@ void chip8::init()
     _programCounter = 0x200;
 
     // Clear stack
-    for (int i = 0; i < sizeof(_stack) / sizeof(unsigned short); ++i)
+    for (unsigned int i = 0; i < sizeof(_stack) / sizeof(unsigned short); ++i)
     {
         _stack[i] = 0;
     }
@@ -60,471 +237,1727 @@ void chip8::init()
     _stackPointer = 0;
 
     // Reset GFX
-    for (int i = 0; i < sizeof(_gfx) / sizeof(unsigned char); ++i)
+    for (unsigned int i = 0; i < sizeof(_gfx) / sizeof(uint64_t); ++i)
     {
         _gfx[i] = 0;
     }
 
     // Reset keys
-    for (int i = 0; i < sizeof(_key) / sizeof(unsigned char); ++i)
-    {
-        _key[i] = 0;
-    }
+    _keys = 0;
+    _waitingForKey = false;
+    _halted = false;
 
     // Reset timers
     _delayTimer = 0;
     _soundTimer = 0;
 
+    _instructions = 0;
+    _frames = 0;
+    resetFrames();
+#ifdef CHIP8_PROFILE
+    _profiler.clear();
+#endif
+
     // Load font set into memory
-    for (int i = 0; i < sizeof(chip8_fontset) / sizeof(unsigned char); ++i)
+    for (unsigned int i = 0; i < sizeof(chip8_fontset) / sizeof(unsigned char); ++i)
     {
         _memory[i] = chip8_fontset[i];
     }
 
+    // Program space is empty again so the cached instructions are stale
+    refreshDecodeCache();
+    if (_jit)
+    {
+        _jit->flush();
+    }
+
     // Clear screen
     setDrawFlag(true);
 
-    // one or more opcodes require RNG
-    srand(time(NULL));
+    // one or more opcodes require RNG, always start from the same seed so runs are reproducible
+    seed(DEFAULT_SEED);
 }
 
 void chip8::cycle()
 {
-    // Fetch opcode from the memory at location specified by program counter
-    // Opcode is stored in two successive bytes and will need to be merged
-    // First half of opcode is shifted 8 bits left, adding 8 zeroes
-    // Bitwise OR operation is used to merge the two halves
-    _opcode = _memory[_programCounter] << 8 | _memory[_programCounter + 1];
+    // The program counter is only 12 bits wide, running off the end of memory wraps around
+    _programCounter &= 0x0FFF;
+
+    // Nothing runs until setKey() delivers the key FX0A is waiting for, or ever again after a bad opcode
+    if (_waitingForKey || _halted)
+    {
+        return;
+    }
+
+#ifdef CHIP8_PROFILE
+    // Every instruction has to be seen, so translated blocks are never run while profiling
+    _profiler.instruction(_programCounter, _memory[_programCounter] << 8 | _memory[(_programCounter + 1) & 0x0FFF]);
+#endif
+
+#ifdef CHIP8_THREADED
+    if (_dispatch == dispatch::THREADED)
+    {
+        (this->*_threaded)(1);
+        return;
+    }
+#endif
+
+    if (_dispatch != dispatch::SWITCH && _programCounter >= PROGRAM_START_ADDRESS && (_programCounter & 1) == 0)
+    {
+        // Program space was decoded ahead of time, so there is nothing to fetch or decode
+        // The record is copied as FX33 and FX55 can write over their own opcode, decoding it again while it runs
+        const instruction ins = _decodeCache[(_programCounter - PROGRAM_START_ADDRESS) >> 1];
+        (this->*ins.execute)(ins);
+    }
+    else
+    {
+        // Fetch opcode from the memory at location specified by program counter
+        // Opcode is stored in two successive bytes and will need to be merged
+        // First half of opcode is shifted 8 bits left, adding 8 zeroes
+        // Bitwise OR operation is used to merge the two halves
+        _opcode = _memory[_programCounter] << 8 | _memory[(_programCounter + 1) & 0x0FFF];
+
+        // Decode and execute opcode
+        const instruction ins = decode(_opcode);
+        (this->*ins.execute)(ins);
+    }
+
+    ++_instructions;
+}
+
+/// Advance the timers by one 60hz tick
+void chip8::tickTimers()
+{
+    if (_delayTimer > 0)
+    {
+        --_delayTimer;
+    }
+
+    if (_soundTimer > 0)
+    {
+        setSoundTimer(_soundTimer - 1);
+    }
+}
+
+/// Set the sound timer, logging the buzzer turning on or off
+void chip8::setSoundTimer(const unsigned char value)
+{
+    if (_soundLog != nullptr && (value > 0) != (_soundTimer > 0))
+    {
+        const soundEvent event = {_instructions, value > 0};
+        _soundLog->push_back(event);
+    }
+    _soundTimer = value;
+}
+
+/// Run one 60th of a second of emulated time: the instructions due in this frame, then one timer tick
+/// With a fixed instruction rate the result never depends on how fast the host is, the host decides
+/// whether to sleep between frames or run them back to back.
+/// With an unlimited rate instructions run until a 60th of a second of real time has passed.
+///
+/// A program polling the delay timer can't make progress before the next tick, so the rest of
+/// the frame is skipped as soon as one is caught doing so, see idleLoop(). With an unlimited rate
+/// the skipped time is slept instead, so the timers still tick at 60hz of real time.
+void chip8::runFrame()
+{
+    pollInput();
+
+    if (_instructionRate == 0)
+    {
+        const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(1000000 / 60);
+        do
+        {
+            // Only look at the clock and the input every so often, they cost more than an instruction
+            pollInput();
+            for (int i = 0; i < 256; ++i)
+            {
+                // Nothing an idle program does can matter before the tick at the end of the frame
+                if (_waitingForKey || _halted || idleLoop() >= 0)
+                {
+                    std::this_thread::sleep_until(end);
+                    break;
+                }
+                step(256);
+            }
+        } while (std::chrono::steady_clock::now() < end);
+    }
+    else
+    {
+        // Count from the start of the run so fractional instructions per frame never drift
+        ++_frame;
+        const uint64_t target = _frameStart + _frame * _instructionRate / 60;
+        while (_instructions < target && !_waitingForKey && !_halted)
+        {
+            const int polled = idleLoop();
+            if (polled >= 0)
+            {
+                // Every pass of the loop reads the same timer value, so the machine ends up exactly
+                // where running the remaining instructions one by one would have left it
+                const uint64_t remaining = target - _instructions;
+                _v[polled] = _delayTimer;
+                _programCounter += 2 * (remaining % 3);
+                _instructions = target;
+                break;
+            }
+            step(target - _instructions);
+        }
+
+        // Time spent waiting for a key is not owed to the program once the key arrives
+        if (_waitingForKey)
+        {
+            resetFrames();
+        }
+    }
+
+    tickTimers();
+    ++_frames;
+}
+
+/// Run the next instruction, a superinstruction or translated block of no more than budget
+/// instructions, or with threaded dispatch up to budget instructions
+/// A threaded run stops early when it is about to read the delay timer, so runFrame() still gets
+/// to see idle loops, and when the program starts waiting for a key.
+void chip8::step(const uint64_t budget)
+{
+#ifndef CHIP8_PROFILE
+    if (_dispatch == dispatch::JIT && !_jit && _instructions >= _jitFrom)
+    {
+        _jit.reset(new jit());
+    }
+
+    if (_dispatch == dispatch::JIT && _jit && !_waitingForKey)
+    {
+        // Run a whole translated block if there is one that fits the budget, otherwise interpret a single instruction
+        _programCounter &= 0x0FFF;
+        const int executed = _jit->run(*this, budget);
+        if (executed > 0)
+        {
+            _instructions += executed;
+            return;
+        }
+    }
+
+    if (_dispatch == dispatch::AOT && _aot && !_waitingForKey)
+    {
+        // Blocks never run past the budget, so frames end on the same instruction as when interpreting
+        _programCounter &= 0x0FFF;
+        const int executed = _aot->run(*this, budget);
+        if (executed > 0)
+        {
+            _instructions += executed;
+            return;
+        }
+    }
+
+    if (_dispatch == dispatch::DECODE_CACHE)
+    {
+        _programCounter &= 0x0FFF;
+        if (!_waitingForKey && _programCounter >= PROGRAM_START_ADDRESS && (_programCounter & 1) == 0)
+        {
+            // Fused instructions never run past the budget, so frames end on the same instruction either way
+            // None of them write memory, so the records they read from the cache can't change under them
+            const int index = (_programCounter - PROGRAM_START_ADDRESS) >> 1;
+            const superinstruction &fused = _superinstructions[index];
+            if (fused.length > 1 && fused.length <= budget)
+            {
+                (this->*fused.execute)(_decodeCache[index]);
+                ++_instructions;
+                return;
+            }
+        }
+    }
+#else
+    // Profiling runs every instruction through cycle() on its own
+    (void)budget;
+#endif
+
+#ifdef CHIP8_THREADED
+    if (_dispatch == dispatch::THREADED)
+    {
+        _programCounter &= 0x0FFF;
+        (this->*_threaded)(budget);
+        return;
+    }
+#endif
+    cycle();
+}
+
+/// Threaded interpreter for one quirk policy
+/// Every handler ends in its own copy of fetch and dispatch, an indirect jump through the opcode
+/// table, so the branch predictor learns which handler tends to follow which instead of sharing
+/// one hard to predict jump between all of them. Memory is read afresh for every instruction,
+/// programs that modify themselves need no special care.
+template <typename QUIRKS>
+void chip8::runThreaded(const uint64_t budget)
+{
+#ifdef CHIP8_THREADED
+    // In the order of opcodeIndex
+    static void *const LABELS[OPCODE_COUNT] = {
+        &&BAD, &&_00E0, &&_00EE, &&_1NNN, &&_2NNN, &&_3XNN, &&_4XNN, &&_5XY0, &&_6XNN, &&_7XNN,
+        &&_8XY0, &&_8XY1, &&_8XY2, &&_8XY3, &&_8XY4, &&_8XY5, &&_8XY6, &&_8XY7, &&_8XYE, &&_9XY0,
+        &&_ANNN, &&_BNNN, &&_CXNN, &&_DXYN, &&_EX9E, &&_EXA1, &&_FX07, &&_FX0A, &&_FX15, &&_FX18,
+        &&_FX1E, &&_FX29, &&_FX33, &&_FX55, &&_FX65};
+
+    if (_waitingForKey || _halted || budget == 0)
+    {
+        return;
+    }
+
+    uint64_t remaining = budget;
+    instruction ins;
+    unsigned short opcode;
+
+// Count the instruction just run, then fetch the next one and jump to its handler
+// The program counter is kept to 12 bits, as cycle() does
+#define FETCH()                                                                    \
+    opcode = _memory[_programCounter] << 8 | _memory[(_programCounter + 1) & 0x0FFF]; \
+    ins.x = (opcode & 0x0F00) >> 8;                                                \
+    ins.y = (opcode & 0x00F0) >> 4;                                                \
+    ins.n = opcode & 0x000F;                                                       \
+    ins.nn = opcode & 0x00FF;                                                      \
+    ins.nnn = opcode & 0x0FFF;                                                     \
+    goto *LABELS[OPCODES.index[opcode]]
+#define NEXT()                          \
+    ++_instructions;                    \
+    if (--remaining == 0)               \
+    {                                   \
+        return;                         \
+    }                                   \
+    _programCounter &= 0x0FFF;          \
+    FETCH()
+
+    FETCH();
+
+BAD:
+    opBad(ins);
+    ++_instructions;
+    return;
+_00E0:
+    op00E0(ins);
+    NEXT();
+_00EE:
+    op00EE(ins);
+    NEXT();
+_1NNN:
+    op1NNN(ins);
+    NEXT();
+_2NNN:
+    op2NNN(ins);
+    NEXT();
+_3XNN:
+    op3XNN(ins);
+    NEXT();
+_4XNN:
+    op4XNN(ins);
+    NEXT();
+_5XY0:
+    op5XY0(ins);
+    NEXT();
+_6XNN:
+    op6XNN(ins);
+    NEXT();
+_7XNN:
+    op7XNN(ins);
+    NEXT();
+_8XY0:
+    op8XY0(ins);
+    NEXT();
+_8XY1:
+    op8XY1(ins);
+    NEXT();
+_8XY2:
+    op8XY2(ins);
+    NEXT();
+_8XY3:
+    op8XY3(ins);
+    NEXT();
+_8XY4:
+    op8XY4(ins);
+    NEXT();
+_8XY5:
+    op8XY5(ins);
+    NEXT();
+_8XY6:
+    op8XY6<QUIRKS>(ins);
+    NEXT();
+_8XY7:
+    op8XY7(ins);
+    NEXT();
+_8XYE:
+    op8XYE<QUIRKS>(ins);
+    NEXT();
+_9XY0:
+    op9XY0(ins);
+    NEXT();
+_ANNN:
+    opANNN(ins);
+    NEXT();
+_BNNN:
+    opBNNN<QUIRKS>(ins);
+    NEXT();
+_CXNN:
+    opCXNN(ins);
+    NEXT();
+_DXYN:
+    opDXYN<QUIRKS>(ins);
+    NEXT();
+_EX9E:
+    opEX9E(ins);
+    NEXT();
+_EXA1:
+    opEXA1(ins);
+    NEXT();
+_FX07:
+    // Hand back to runFrame() before a timer read, unless it is the first instruction of the run
+    if (remaining != budget)
+    {
+        return;
+    }
+    opFX07(ins);
+    NEXT();
+_FX0A:
+    opFX0A(ins);
+    if (_waitingForKey)
+    {
+        ++_instructions;
+        return;
+    }
+    NEXT();
+_FX15:
+    opFX15(ins);
+    NEXT();
+_FX18:
+    opFX18(ins);
+    NEXT();
+_FX1E:
+    opFX1E(ins);
+    NEXT();
+_FX29:
+    opFX29(ins);
+    NEXT();
+_FX33:
+    opFX33(ins);
+    NEXT();
+_FX55:
+    opFX55<QUIRKS>(ins);
+    NEXT();
+_FX65:
+    opFX65<QUIRKS>(ins);
+    NEXT();
+
+#undef NEXT
+#undef FETCH
+#else
+    (void)budget;
+#endif
+}
+
+/// Check for the usual way of waiting on the delay timer at the program counter:
+///     FX07        VX = delay timer
+///     3XNN        leave the loop once VX == NN
+///     1NNN        back to the FX07
+/// Returns X if the loop can't end before the next timer tick, because the timer doesn't hold NN,
+/// otherwise -1. Profiling builds never skip anything, so their counts stay exact.
+///
+/// Only this exact shape is recognised, with the jump going straight back to the FX07. Loops that
+/// poll with 4XNN, do anything else between the reads or jump back somewhere else are not proven
+/// free of side effects and simply run instruction by instruction.
+int chip8::idleLoop() const
+{
+#ifdef CHIP8_PROFILE
+    return -1;
+#else
+    const unsigned short address = _programCounter & 0x0FFF;
+    if (address > 0x0FFA)
+    {
+        return -1;
+    }
+
+    const unsigned char *code = _memory + address;
+    if ((code[0] & 0xF0) != 0xF0 || code[1] != 0x07)
+    {
+        return -1;
+    }
+
+    const int x = code[0] & 0x0F;
+    if (code[2] != (0x30 | x) || code[3] == _delayTimer)
+    {
+        return -1;
+    }
+
+    if (code[4] != (0x10 | address >> 8) || code[5] != (address & 0xFF))
+    {
+        return -1;
+    }
+
+    return x;
+#endif
+}
+
+/// Set how many instructions run per second of emulated time, 0 to run as many as the host can
+void chip8::setInstructionRate(const unsigned int perSecond)
+{
+    _instructionRate = perSecond;
+    resetFrames();
+}
+
+/// Start counting frames from the current instruction
+void chip8::resetFrames()
+{
+    _frameStart = _instructions;
+    _frame = 0;
+}
+
+/// Decode an opcode by checking the opcode table to see what it means
+/// This is the only place that knows the opcode encoding, both dispatch modes go through it
+chip8::instruction chip8::decode(const unsigned short opcode) const
+{
+    return (this->*_decoder)(opcode);
+}
 
-    // Decode Opcode and check opcode table to see what it means
-    switch (_opcode & 0xF000)
+/// Decode an opcode into the handlers specialised for one quirk policy
+template <typename QUIRKS>
+chip8::instruction chip8::decodeWith(const unsigned short opcode) const
+{
+    instruction ins;
+    ins.execute = &chip8::opBad;
+    ins.x = (opcode & 0x0F00) >> 8;
+    ins.y = (opcode & 0x00F0) >> 4;
+    ins.n = opcode & 0x000F;
+    ins.nn = opcode & 0x00FF;
+    ins.nnn = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000)
     {
         // Multiple 0x0 opcodes so switch again and compare last four bits
     case 0x0000:
-        switch (_opcode & 0x000F)
+        switch (opcode & 0x000F)
         {
-            // 00E0 Clears the screen
         case 0x0000:
-            // TODO: Implement 00E0
+            ins.execute = &chip8::op00E0;
             break;
-            // 00EE Returns from a subroutine
         case 0x000E:
-            // TODO: Implement 00EE
+            ins.execute = &chip8::op00EE;
             break;
-        default:
-            printf("Bad opcode: 0x%X\n", _opcode);
         }
         break;
 
-        // 1NNN (0x1NNN): Jumps to address NNN
     case 0x1000:
-        // Set program counter to address NNN
-        _programCounter = _opcode & 0x0FFF;
+        ins.execute = &chip8::op1NNN;
         break;
 
-        // 2NNN (0x2NNN): Calls subroutine at NNN
     case 0x2000:
-        // Store current address in stack
-        _stack[_stackPointer] = _programCounter;
-        // Increment Stack Pointer
-        ++_stackPointer;
-        // Set the program counter to the address of NNN
-        _programCounter = _opcode & 0x0FFF;
+        ins.execute = &chip8::op2NNN;
         break;
 
-        // 3XNN (0x3XNN): Skips the next instruction if VX equals NN (Usually the next instruction is a jump to skip a code block)
     case 0x3000:
-        if (_v[(_opcode & 0x0F00) >> 8] == _opcode & 0x00FF)
-        {
-            // Skip the next instruction
-            _programCounter += 4;
-        }
-        else
-        {
-            // Move to next instruction
-            _programCounter += 2;
-        }
+        ins.execute = &chip8::op3XNN;
         break;
 
-        // 4XNN (0x4XNN): Skips the next instruction if VX does not equal NN (Usually the next instruction is a jump to skip a code block)
     case 0x4000:
-        if (_v[(_opcode & 0x0F00) >> 8] != _opcode & 0x00FF)
-        {
-            // Skip next instruction
-            _programCounter += 4;
-        }
-        else
-        {
-            // Move to next instruction
-            _programCounter += 2;
-        }
+        ins.execute = &chip8::op4XNN;
         break;
 
-        // 5XY0 (0x5XY0): Skips the next instruction if VX equals VY (Usually the next instruction is a jump to skip a code block)
     case 0x5000:
-        if (_v[(_opcode & 0x0F00) >> 8] == _v[(_opcode & 0x00F0) >> 4])
-        {
-            // Skip next instruction
-            _programCounter += 4;
-        }
-        else
-        {
-            // Move to next instruction
-            _programCounter += 2;
-        }
+        ins.execute = &chip8::op5XY0;
         break;
 
-        // 6XNN (0x6XNN): Sets VX to NN
     case 0x6000:
-        _v[(_opcode & 0x0F00) >> 8] = _opcode & 0x00FF;
-
-        // Move to next instruction
-        _programCounter += 2;
+        ins.execute = &chip8::op6XNN;
         break;
 
-        // 7XNN (0x7XNN): Adds NN to VX (Carry flag is not changed)
     case 0x7000:
-        _v[(_opcode & 0x0F00) >> 8] += _opcode & 0x00FF;
-
-        // Move to next instruction
-        _programCounter += 2;
+        ins.execute = &chip8::op7XNN;
         break;
 
         // Multiple 0x8 opcodes so switch again and compare last four bits
     case 0x8000:
-        switch (_opcode & 0x000F)
+        switch (opcode & 0x000F)
         {
-        // 8XY0 (0x8XY0): Sets VX to the value of VY
         case 0x0000:
-            _v[(_opcode & 0x0F00) >> 8] = _v[(_opcode & 0x00F0) >> 4];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY0;
             break;
-
-        // 8XY1 (0x8XY1): Sets VX to VX or VY (Bitwise OR operation)
         case 0x0001:
-            _v[(_opcode & 0x0F00) >> 8] |= _v[(_opcode & 0x00F0) >> 4];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY1;
             break;
-
-        // 8XY2 (0x8XY2): Sets VX to VX and VY (Bitwise AND operation)
         case 0x0002:
-            _v[(_opcode & 0x0F00) >> 8] &= _v[(_opcode & 0x00F0) >> 4];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY2;
             break;
-
-        // 8XY3 (0x8XY3): Sets VX to VX xor VY.
         case 0x0003:
-            _v[(_opcode & 0x0F00) >> 8] ^= _v[(_opcode & 0x00F0) >> 4];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY3;
             break;
-
-        // 8XY4 (0x8XY4): Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there is not
         case 0x0004:
-            // Check if VY is larger than VX
-            if (_v[(_opcode & 0x00F0) >> 4] > _v[(_opcode & 0x0F00) >> 8])
-            {
-                // VY is larger so set VF to 1 because there is a carry
-                _v[0xF] = 1;
-            }
-            else
-            {
-                // VY is not larger so set VF to 0 as there is no carry
-                _v[0xF] = 0;
-            }
-
-            // Add VY to VX
-            _v[(_opcode & 0x0F00) >> 8] += _v[(_opcode & 0x00F0) >> 4];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY4;
             break;
-
-        // 8XY5 (0x8XY5): VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there is not
         case 0x0005:
-            // Check if VY is larger than VX
-            if (_v[(_opcode & 0x00F0) >> 4] > _v[(_opcode & 0x0F00) >> 8])
-            {
-                // VY is larger so set VF to 0 because there is a borrow
-                _v[0xF] = 0;
-            }
-            else
-            {
-                // VY is not larger so set VF to 1 as there is no borrow
-                _v[0xF] = 1;
-            }
-
-            // Subtract VY from VX
-            _v[(_opcode & 0x0F00) >> 8] -= _v[(_opcode & 0x00F0) >> 4];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY5;
             break;
-
-        // 8XY6 (0x8XY6): Stores the least significant bit of VX in VF and then shifts VX to the right by 1
         case 0x0006:
-            // Store least significant bit (...& 0x1) in VF
-            _v[0xF] = _v[(_opcode & 0x0F00) >> 8] & 0x1;
-
-            // Shift VX to the right by 1
-            _v[(_opcode & 0x0F00) >> 8] >>= 1;
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY6<QUIRKS>;
             break;
-
-        // 8XY7 (0x8XY7): Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there is not
         case 0x0007:
-            // Check if VX is larger than VY
-            if (_v[(_opcode & 0x0F00) >> 8] > _v[(_opcode & 0x00F0) >> 4])
-            {
-                // VX is larger so set VF to 0 because there is a borrow
-                _v[0xF] = 0;
-            }
-            else
-            {
-                // VX is not larger so set VF to 1 because there is no borrow
-                _v[0xF] = 1;
-            }
-
-            // VX = VY - VX
-            _v[(_opcode & 0x0F00) >> 8] = _v[(_opcode & 0x00F0) >> 4] - _v[(_opcode & 0x0F00) >> 8];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XY7;
             break;
-
-        // 8XYE (0x8XYE): Stores the most significant bit of VX in VF and then shifts VX to the left by 1
         case 0x000E:
-            // Store most significant bit (...& 0x0) in VF
-            _v[0xF] = _v[(_opcode & 0x0F00) >> 8] >> 7;
-
-            // Shift VX to the left by 1
-            _v[(_opcode & 0x0F00) >> 8] <<= 1;
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::op8XYE<QUIRKS>;
             break;
-
-        default:
-            printf("Bad opcode: 0x%X\n", _opcode);
         }
         break;
 
-        // 9XY0 (0x9XY0): Skips the next instruction if VX does not equal VY (Usually the next instruction is a jump to skip a code block)
     case 0x9000:
-        if (_v[(_opcode & 0x0F00) >> 8] != _v[(_opcode & 0x00F0) >> 8])
-        {
-            // Skip next instruction
-            _programCounter += 4;
-        }
-        else
-        {
-            // Move to next instruction
-            _programCounter += 2;
-        }
+        ins.execute = &chip8::op9XY0;
         break;
 
-        // ANNN (0xANNN): Sets index register to the address NNN
     case 0xA000:
-        _indexRegister = _opcode & 0x0FFF;
-
-        // Move to next instruction
-        _programCounter += 2;
+        ins.execute = &chip8::opANNN;
         break;
 
-        // BNNN (0xBNNN): Jumps to the address NNN plus V0
     case 0xB000:
-        _programCounter = (_opcode & 0x0FFF) + _v[0];
+        ins.execute = &chip8::opBNNN<QUIRKS>;
         break;
 
-        // CXNN (0xCXNN): Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN
     case 0xC000:
-        // "rand() & 0xFF" gives a random number between 0 and 255 (0xFF)
-        _v[(_opcode & 0x0F00) >> 8] = (_opcode & 0x00FF) & (rand() & 0xFF);
-
-        // Move to next instruction
-        _programCounter += 2;
+        ins.execute = &chip8::opCXNN;
         break;
 
-        // DXYN (0xDXYN): Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N+1 pixels.
-        // Each row of 8 pixels is read as bit-coded starting from memory location I; I value does not change after the execution of this instruction.
-        // As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that does not happen
     case 0xD000:
-        // TODO: Implement DXYN
+        ins.execute = &chip8::opDXYN<QUIRKS>;
         break;
 
         // Multiple 0xE opcodes so switch again and compare last eight bits
     case 0xE000:
-        switch (_opcode & 0x00FF)
+        switch (opcode & 0x00FF)
         {
-        // EX9E (0xEX9E): Skips the next instruction if the key stored in VX is pressed (Usually the next instruction is a jump to skip a code block)
         case 0x009E:
-            // TODO: Implement EX9E
+            ins.execute = &chip8::opEX9E;
             break;
-
-        // EXA1 (0xEXA1): Skips the next instruction if the key stored in VX is not pressed (Usually the next instruction is a jump to skip a code block)
         case 0x00A1:
-            // TODO: Implement EXA1
+            ins.execute = &chip8::opEXA1;
             break;
-        default:
-            printf("Bad opcode: 0x%X\n", _opcode);
         }
         break;
 
         // Multiple 0xF opcodes so switch again and compare last eight bits
     case 0xF000:
-        switch (_opcode & 0x00FF)
+        switch (opcode & 0x00FF)
         {
-            // FX07 (0xFX07): Sets VX to the value of the delay timer
         case 0x0007:
-            _v[(_opcode & 0x0F00) >> 8] = _delayTimer;
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::opFX07;
             break;
-
-            // FX0A (0xFX0A): A key press is awaited, and then stored in VX (Blocking Operation. All instruction halted until next key event)
         case 0x000A:
-            // TODO: Implement FX0A
+            ins.execute = &chip8::opFX0A;
             break;
-
-            // FX15 (0xFX15): Sets the delay timer to VX
         case 0x0015:
-            _delayTimer = _v[(_opcode & 0x0F00) >> 8];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::opFX15;
             break;
-
-            // FX18 (0xFX18): Sets the sound timer to VX
         case 0x0018:
-            _soundTimer = _v[(_opcode & 0x0F00) >> 8];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::opFX18;
             break;
-
-            // FX1E (0xFX1E): Adds VX to I. VF is not affected
         case 0x001E:
-            // VF is set to 1 if range overflows (index register + VX > 0xFFF)
-            if (_indexRegister + _v[(_opcode & 0x0F00) >> 8] > 0xFFF)
-            {
-                _v[0xF] = 1;
-            }
-            else
-            {
-                _v[0xF] = 0;
-            }
-            _indexRegister += _v[(_opcode & 0x0F00) >> 8];
-
-            // Move to next instruction
-            _programCounter += 2;
+            ins.execute = &chip8::opFX1E;
             break;
-
-            // FX29 (0xFX29): Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font
         case 0x0029:
-            // TODO: Implement FX29
+            ins.execute = &chip8::opFX29;
             break;
-
-            // FX33 (0xFX33): Stores the binary-coded decimal representation of VX, with the most significant of three digits at the address in I,
-            // the middle digit at I plus 1, and the least significant digit at I plus 2
-            // (In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2)
         case 0x0033:
-            // TODO: Implement FX33
+            ins.execute = &chip8::opFX33;
             break;
-
-            // FX55 (0xFX55): Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
         case 0x0055:
-            // TODO: Implement FX55
+            ins.execute = &chip8::opFX55<QUIRKS>;
             break;
-            // FX65 (0xFX65): Fills V0 to VX (including VX) with values from memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
         case 0x0065:
-            // TODO: Implement FX65
+            ins.execute = &chip8::opFX65<QUIRKS>;
             break;
-        default:
-            printf("Bad opcode: 0x%X\n", _opcode);
         }
         break;
-
-    default:
-        printf("Bad opcode: 0x%X\n", _opcode);
     }
 
-    // Execute Opcode
+    return ins;
+}
 
-    // Update Timers
-    if (_delayTimer > 0)
+/// Re-decode every instruction in program space
+void chip8::refreshDecodeCache()
+{
+    ownDecoded();
+    for (unsigned int i = 0; i < sizeof(decodedPage::records) / sizeof(instruction); ++i)
     {
-        --_delayTimer;
+        const unsigned short address = PROGRAM_START_ADDRESS + i * 2;
+        _decodeCache[i] = decode(_memory[address] << 8 | _memory[address + 1]);
     }
 
-    if (_soundTimer > 0)
+    for (unsigned int i = 0; i < sizeof(decodedPage::fused) / sizeof(superinstruction); ++i)
     {
-        if (_soundTimer == 1)
-        {
-            printf("BEEP\n");
-            --_soundTimer;
-        }
+        fuse(i);
     }
 }
 
-bool chip8::drawFlag()
+/// Decode the cached instruction at an even address in program space again after its bytes changed
+/// Superinstructions that start up to two instructions earlier can include it, so they are looked for again too.
+void chip8::redecode(const unsigned short address)
 {
-    return _drawFlag;
-}
+    ownDecoded();
+    const int index = (address - PROGRAM_START_ADDRESS) >> 1;
+    _decodeCache[index] = decode(_memory[address] << 8 | _memory[address + 1]);
 
-void chip8::setDrawFlag(const bool flag)
-{
-    _drawFlag = flag;
+    for (int i = index >= 2 ? index - 2 : 0; i <= index; ++i)
+    {
+        fuse(i);
+    }
 }
 
-bool chip8::load(const char *path)
+/// Look for a superinstruction at one entry of the decode cache
+/// The sequences are the most frequent ones the idioms tool finds in ROMs, weighted by how often they run:
+///     ANNN DXYN           point I at a sprite and draw it
+///     6XNN 6YNN           set both coordinates of a sprite
+///     7XNN 3XNN 1NNN      count VX up and loop until it reaches NN
+/// Polling the delay timer with FX07 3XNN 1NNN is left to idleLoop(), which skips the whole wait rather than fusing it.
+/// Matched on the bytes in memory, as the cached records next to this one may be superinstructions themselves.
+void chip8::fuse(const int index)
 {
-    FILE *program = fopen(path, "rb");
-    if (program == nullptr)
+    superinstruction &fused = _superinstructions[index];
+    fused.execute = nullptr;
+    fused.length = 0;
+
+    const unsigned short address = PROGRAM_START_ADDRESS + index * 2;
+    unsigned short opcodes[3] = {};
+    const int available = (MEMORY_SIZE - address) / 2 < 3 ? (MEMORY_SIZE - address) / 2 : 3;
+    for (int i = 0; i < available; ++i)
     {
-        fputs("Could not open program", stderr);
-        return false;
+        opcodes[i] = _memory[address + i * 2] << 8 | _memory[address + i * 2 + 1];
     }
 
-    // Check size of program
-    fseek(program, 0, SEEK_END);
-    long programSize = ftell(program);
-    rewind(program);
-    fputs("Program size is " + (int)programSize, stdout);
+    if (available == 3 && (opcodes[0] & 0xF000) == 0x7000 && (opcodes[1] & 0xF000) == 0x3000 && (opcodes[2] & 0xF000) == 0x1000 &&
+        (opcodes[0] & 0x0F00) == (opcodes[1] & 0x0F00))
+    {
+        fused.execute = &chip8::op7XNN3XNN1NNN;
+        fused.length = 3;
+        return;
+    }
 
-    // Allocate memory for program
-    char *buffer = (char *)malloc(sizeof(char) * programSize);
+    if (available >= 2 && (opcodes[0] & 0xF000) == 0xA000 && (opcodes[1] & 0xF000) == 0xD000)
+    {
+        fused.execute = withQuirks(_quirks, [](auto policy)
+                                   { return &chip8::opANNNDXYN<decltype(policy)>; });
+        fused.length = 2;
+    }
+    else if (available >= 2 && (opcodes[0] & 0xF000) == 0x6000 && (opcodes[1] & 0xF000) == 0x6000)
+    {
+        fused.execute = &chip8::op6XNN6YNN;
+        fused.length = 2;
+    }
+}
 
-    // Copy the program into the buffer
-    size_t result = fread(buffer, sizeof(char), programSize, program);
+/// Store a byte in memory on behalf of a running program
+/// Only the cached instruction that contains the byte is decoded again, and translated code is flushed if it was built from it
+void chip8::writeMemory(const unsigned short address, const unsigned char value)
+{
+    // Keep the write inside our 4KB, as I can be pointed anywhere
+    const unsigned short wrapped = address & 0x0FFF;
+    ownMemory();
+    _memory[wrapped] = value;
 
-    // Check if we can fit the program into our memory
-    // and if we can, load the buffer into memory
-    if (programSize > sizeof(_memory) - PROGRAM_START_ADDRESS)
+    if (wrapped >= PROGRAM_START_ADDRESS)
     {
-        fputs("Program file size is too big", stderr);
-        return false;
+        redecode(wrapped & 0x0FFE);
+    }
+
+    if (_jit)
+    {
+        _jit->invalidate(wrapped);
+    }
+    if (_aot)
+    {
+        _aot->invalidate(wrapped);
+    }
+}
+
+/// Expand the screen into one byte per pixel (0 or 1), 64 * 32 bytes written row by row
+void chip8::expandGfx(unsigned char *pixels) const
+{
+    for (int y = 0; y < 32; ++y)
+    {
+        for (int x = 0; x < 64; ++x)
+        {
+            pixels[y * 64 + x] = (_gfx[y] >> (63 - x)) & 1;
+        }
+    }
+}
+
+/// The screen as 32 rows, bit 63 of a row is its leftmost pixel
+const uint64_t *chip8::gfx() const
+{
+    return _gfx;
+}
+
+uint64_t chip8::instructions() const
+{
+    return _instructions;
+}
+
+uint64_t chip8::frames() const
+{
+    return _frames;
+}
+
+/// Fingerprint of everything a program can observe: memory, registers, stack, timers and screen
+uint64_t chip8::stateHash() const
+{
+    uint64_t hash = fnv1a(_memory, MEMORY_SIZE);
+    hash = fnv1a(_v, sizeof(_v), hash);
+    hash = fnv1a(&_indexRegister, sizeof(_indexRegister), hash);
+    hash = fnv1a(&_programCounter, sizeof(_programCounter), hash);
+    hash = fnv1a(_stack, sizeof(_stack), hash);
+    hash = fnv1a(&_stackPointer, sizeof(_stackPointer), hash);
+    hash = fnv1a(&_delayTimer, sizeof(_delayTimer), hash);
+    hash = fnv1a(&_soundTimer, sizeof(_soundTimer), hash);
+    return fnv1a(_gfx, sizeof(_gfx), hash);
+}
+
+/// Fingerprint of the screen alone
+uint64_t chip8::gfxHash() const
+{
+    return fnv1a(_gfx, sizeof(_gfx));
+}
+
+/// Hash of the V registers alone
+uint64_t chip8::vHash() const
+{
+    return fnv1a(_v, sizeof(_v));
+}
+
+/// Hash of the whole 4KB of memory alone
+uint64_t chip8::memoryHash() const
+{
+    return fnv1a(_memory, MEMORY_SIZE);
+}
+
+/// Restart the random number generator from a seed
+void chip8::seed(const uint64_t value)
+{
+    _random = pcg32Seed(value);
+}
+
+void chip8::setKey(const unsigned char key, const bool pressed)
+{
+    if (pressed)
+    {
+        _keys |= 1 << (key & 0xF);
+    }
+    else
+    {
+        _keys &= ~(1 << (key & 0xF));
+    }
+
+    if (pressed && _waitingForKey)
+    {
+        // Finish the FX0A the machine is blocked on
+        _v[_memory[_programCounter] & 0x0F] = key & 0xF;
+        _programCounter += 2;
+        _waitingForKey = false;
+    }
+}
+
+/// Take key events from a queue the host fills, between instructions in runFrame() and pollInput()
+void chip8::setInputQueue(keyQueue *queue)
+{
+    _input = queue;
+}
+
+/// Record every time the buzzer turns on or off into a log the host owns and empties
+/// Nothing is recorded without one, so machines nobody listens to don't pay for it.
+void chip8::setSoundLog(std::vector<soundEvent> *log)
+{
+    _soundLog = log;
+}
+
+/// True while the buzzer sounds
+bool chip8::buzzing() const
+{
+    return _soundTimer > 0;
+}
+
+/// Apply every key event waiting in the input queue
+void chip8::pollInput()
+{
+    if (_input == nullptr)
+    {
+        return;
+    }
+
+    keyEvent event;
+    while (_input->pop(event))
+    {
+        setKey(event.key, event.pressed);
+        if (_inputTime == 0)
+        {
+            _inputTime = event.time;
+        }
+    }
+}
+
+/// Time stamp of the oldest key event applied since the last call, or 0, for measuring input latency
+uint64_t chip8::takeInputTime()
+{
+    const uint64_t time = _inputTime;
+    _inputTime = 0;
+    return time;
+}
+
+/// True while FX0A blocks the machine until a key is pressed, cycle() does nothing meanwhile
+bool chip8::waitingForKey() const
+{
+    return _waitingForKey;
+}
+
+/// True after a bad opcode, nothing runs any more, see opBad()
+bool chip8::halted() const
+{
+    return _halted;
+}
+
+/// The opcode at the program counter, the one that halted the machine if halted() is set
+unsigned short chip8::badOpcode() const
+{
+    return _memory[_programCounter & 0x0FFF] << 8 | _memory[(_programCounter + 1) & 0x0FFF];
+}
+
+/// True when nothing at all can change before a key is pressed, not even the timers
+/// A host can stop running frames until its next key event instead of spinning.
+bool chip8::parked() const
+{
+    return (_waitingForKey || _halted) && _delayTimer == 0 && _soundTimer == 0;
+}
+
+/// Copy memory before writing to it if a fork or snapshot still shares it
+void chip8::ownMemory()
+{
+    if (_memoryPage.use_count() > 1)
+    {
+        _memoryPage.reset(new memoryPage(*_memoryPage));
+        _memory = _memoryPage->bytes;
+    }
+}
+
+/// Copy the decoded records before changing them if a fork still shares them
+void chip8::ownDecoded()
+{
+    if (_decodedPage.use_count() > 1)
+    {
+        _decodedPage.reset(new decodedPage(*_decodedPage));
+        _decodeCache = _decodedPage->records;
+        _superinstructions = _decodedPage->fused;
+    }
+}
+
+/// Take a snapshot of the whole machine
+/// Memory is not copied, the machine copies it the next time it writes instead
+chip8::state chip8::snapshot() const
+{
+    state saved;
+    saved.memory = _memoryPage;
+    memcpy(saved.v, _v, sizeof(_v));
+    saved.indexRegister = _indexRegister;
+    saved.programCounter = _programCounter;
+    memcpy(saved.gfx, _gfx, sizeof(_gfx));
+    saved.delayTimer = _delayTimer;
+    saved.soundTimer = _soundTimer;
+    memcpy(saved.stack, _stack, sizeof(_stack));
+    saved.stackPointer = _stackPointer;
+    saved.keys = _keys;
+    saved.waitingForKey = _waitingForKey;
+    saved.halted = _halted;
+    saved.random = _random;
+    saved.instructions = _instructions;
+    saved.frames = _frames;
+    saved.frameStart = _frameStart;
+    saved.frame = _frame;
+    return saved;
+}
+
+/// Put the machine back to a snapshot
+/// Only instructions whose bytes differ between the current and restored memory are decoded again
+void chip8::restore(const state &saved)
+{
+    if (saved.memory != _memoryPage)
+    {
+        const std::shared_ptr<memoryPage> previous = _memoryPage;
+
+        // The snapshot keeps its page read only, we share it until our next write
+        _memoryPage = std::const_pointer_cast<memoryPage>(saved.memory);
+        _memory = _memoryPage->bytes;
+
+        for (int address = PROGRAM_START_ADDRESS; address < MEMORY_SIZE; address += 2)
+        {
+            if (_memory[address] != previous->bytes[address] || _memory[address + 1] != previous->bytes[address + 1])
+            {
+                redecode(address);
+                if (_jit)
+                {
+                    _jit->invalidate(address);
+                    _jit->invalidate(address + 1);
+                }
+                if (_aot)
+                {
+                    _aot->invalidate(address);
+                    _aot->invalidate(address + 1);
+                }
+            }
+        }
+    }
+
+    memcpy(_v, saved.v, sizeof(_v));
+    _indexRegister = saved.indexRegister;
+    _programCounter = saved.programCounter;
+
+    // Whatever differs from the restored screen has to be redrawn
+    for (int y = 0; y < 32; ++y)
+    {
+        _dirty[y] |= _gfx[y] ^ saved.gfx[y];
+        _gfx[y] = saved.gfx[y];
+    }
+
+    _delayTimer = saved.delayTimer;
+    memcpy(_stack, saved.stack, sizeof(_stack));
+    _stackPointer = saved.stackPointer;
+    _keys = saved.keys;
+    _waitingForKey = saved.waitingForKey;
+    _halted = saved.halted;
+    _random = saved.random;
+    _instructions = saved.instructions;
+    _frames = saved.frames;
+    _frameStart = saved.frameStart;
+    _frame = saved.frame;
+    setSoundTimer(saved.soundTimer);
+}
+
+/// Create a new machine in the same state as this one
+/// Both machines share memory and decoded records until one of them writes to memory, so forking
+/// copies little more than the registers and screen
+///
+/// Translated code is not shared. A fork of a JIT machine runs on the shared decode cache at first,
+/// and only builds its own 1MB code cache once it has run FORK_JIT_WARMUP instructions, so the many
+/// short lived forks of a search never pay for one. Results are the same either way.
+std::unique_ptr<chip8> chip8::fork() const
+{
+    std::unique_ptr<chip8> child(new chip8(_memoryPage, _decodedPage));
+    child->_opcode = _opcode;
+    memcpy(child->_gfx, _gfx, sizeof(_gfx));
+    memcpy(child->_dirty, _dirty, sizeof(_dirty));
+    child->restore(snapshot());
+    child->_instructionRate = _instructionRate;
+    child->_quirks = _quirks;
+    child->_decoder = _decoder;
+    child->_threaded = _threaded;
+    if (_aot)
+    {
+        child->_aot.reset(new aot(*_aot));
+    }
+    child->_dispatch = _dispatch;
+    child->_jitFrom = _instructions + FORK_JIT_WARMUP;
+    return child;
+}
+
+#ifdef CHIP8_PROFILE
+const profiler &chip8::profile() const
+{
+    return _profiler;
+}
+#endif
+
+void chip8::setDispatch(const dispatch mode)
+{
+    if (mode == dispatch::JIT && !_jit)
+    {
+        _jit.reset(new jit());
+    }
+    _dispatch = mode;
+}
+
+/// Pick the interpreter quirks the program expects, usually once before loading it
+/// Everything already decoded or translated is thrown away, the handlers that differ are separate
+/// instantiations so nothing checks the preset while the program runs.
+void chip8::setQuirks(const quirks preset)
+{
+    _quirks = preset;
+    _decoder = withQuirks(preset, [](auto policy)
+                          { return &chip8::decodeWith<decltype(policy)>; });
+    _threaded = withQuirks(preset, [](auto policy)
+                           { return &chip8::runThreaded<decltype(policy)>; });
+
+    refreshDecodeCache();
+    if (_jit)
+    {
+        _jit->flush();
+    }
+}
+
+// 00E0 Clears the screen
+void chip8::op00E0(const instruction &)
+{
+    for (int y = 0; y < 32; ++y)
+    {
+        // Every lit pixel changes
+        _dirty[y] |= _gfx[y];
+        _gfx[y] = 0;
+    }
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 00EE Returns from a subroutine
+void chip8::op00EE(const instruction &)
+{
+    // Decrement Stack Pointer
+    --_stackPointer;
+    // Continue after the call that pushed the return address
+    _programCounter = _stack[_stackPointer & 0xF] + 2;
+}
+
+// 1NNN (0x1NNN): Jumps to address NNN
+void chip8::op1NNN(const instruction &ins)
+{
+    // Set program counter to address NNN
+    _programCounter = ins.nnn;
+}
+
+// 2NNN (0x2NNN): Calls subroutine at NNN
+void chip8::op2NNN(const instruction &ins)
+{
+    // Store current address in stack, a program nesting deeper than 16 calls wraps around rather than overrunning it
+    _stack[_stackPointer & 0xF] = _programCounter;
+    // Increment Stack Pointer
+    ++_stackPointer;
+    // Set the program counter to the address of NNN
+    _programCounter = ins.nnn;
+}
+
+// 3XNN (0x3XNN): Skips the next instruction if VX equals NN (Usually the next instruction is a jump to skip a code block)
+void chip8::op3XNN(const instruction &ins)
+{
+    if (_v[ins.x] == ins.nn)
+    {
+        // Skip the next instruction
+        _programCounter += 4;
+    }
+    else
+    {
+        // Move to next instruction
+        _programCounter += 2;
+    }
+}
+
+// 4XNN (0x4XNN): Skips the next instruction if VX does not equal NN (Usually the next instruction is a jump to skip a code block)
+void chip8::op4XNN(const instruction &ins)
+{
+    if (_v[ins.x] != ins.nn)
+    {
+        // Skip next instruction
+        _programCounter += 4;
+    }
+    else
+    {
+        // Move to next instruction
+        _programCounter += 2;
+    }
+}
+
+// 5XY0 (0x5XY0): Skips the next instruction if VX equals VY (Usually the next instruction is a jump to skip a code block)
+void chip8::op5XY0(const instruction &ins)
+{
+    if (_v[ins.x] == _v[ins.y])
+    {
+        // Skip next instruction
+        _programCounter += 4;
+    }
+    else
+    {
+        // Move to next instruction
+        _programCounter += 2;
+    }
+}
+
+// 6XNN (0x6XNN): Sets VX to NN
+void chip8::op6XNN(const instruction &ins)
+{
+    _v[ins.x] = ins.nn;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 7XNN (0x7XNN): Adds NN to VX (Carry flag is not changed)
+void chip8::op7XNN(const instruction &ins)
+{
+    _v[ins.x] += ins.nn;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY0 (0x8XY0): Sets VX to the value of VY
+void chip8::op8XY0(const instruction &ins)
+{
+    _v[ins.x] = _v[ins.y];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY1 (0x8XY1): Sets VX to VX or VY (Bitwise OR operation)
+void chip8::op8XY1(const instruction &ins)
+{
+    _v[ins.x] |= _v[ins.y];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY2 (0x8XY2): Sets VX to VX and VY (Bitwise AND operation)
+void chip8::op8XY2(const instruction &ins)
+{
+    _v[ins.x] &= _v[ins.y];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY3 (0x8XY3): Sets VX to VX xor VY.
+void chip8::op8XY3(const instruction &ins)
+{
+    _v[ins.x] ^= _v[ins.y];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY4 (0x8XY4): Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there is not
+void chip8::op8XY4(const instruction &ins)
+{
+    // Check if VY is larger than VX
+    if (_v[ins.y] > _v[ins.x])
+    {
+        // VY is larger so set VF to 1 because there is a carry
+        _v[0xF] = 1;
+    }
+    else
+    {
+        // VY is not larger so set VF to 0 as there is no carry
+        _v[0xF] = 0;
+    }
+
+    // Add VY to VX
+    _v[ins.x] += _v[ins.y];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY5 (0x8XY5): VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there is not
+void chip8::op8XY5(const instruction &ins)
+{
+    // Check if VY is larger than VX
+    if (_v[ins.y] > _v[ins.x])
+    {
+        // VY is larger so set VF to 0 because there is a borrow
+        _v[0xF] = 0;
+    }
+    else
+    {
+        // VY is not larger so set VF to 1 as there is no borrow
+        _v[0xF] = 1;
+    }
+
+    // Subtract VY from VX
+    _v[ins.x] -= _v[ins.y];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY6 (0x8XY6): Stores the least significant bit of VX in VF and then shifts VX to the right by 1
+template <typename QUIRKS>
+void chip8::op8XY6(const instruction &ins)
+{
+    // The VIP shifts VY into VX, later interpreters shift VX in place
+    // Both results come from the source before either is stored, and the flag is stored last so it wins when X is F
+    const unsigned char source = _v[QUIRKS::SHIFT_READS_VY ? ins.y : ins.x];
+
+    // Shift to the right by 1
+    _v[ins.x] = source >> 1;
+
+    // Store least significant bit (...& 0x1) in VF
+    _v[0xF] = source & 0x1;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XY7 (0x8XY7): Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there is not
+void chip8::op8XY7(const instruction &ins)
+{
+    // Check if VX is larger than VY
+    if (_v[ins.x] > _v[ins.y])
+    {
+        // VX is larger so set VF to 0 because there is a borrow
+        _v[0xF] = 0;
+    }
+    else
+    {
+        // VX is not larger so set VF to 1 because there is no borrow
+        _v[0xF] = 1;
+    }
+
+    // VX = VY - VX
+    _v[ins.x] = _v[ins.y] - _v[ins.x];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 8XYE (0x8XYE): Stores the most significant bit of VX in VF and then shifts VX to the left by 1
+template <typename QUIRKS>
+void chip8::op8XYE(const instruction &ins)
+{
+    const unsigned char source = _v[QUIRKS::SHIFT_READS_VY ? ins.y : ins.x];
+
+    // Shift to the left by 1
+    _v[ins.x] = source << 1;
+
+    // Store most significant bit (...& 0x0) in VF
+    _v[0xF] = source >> 7;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// 9XY0 (0x9XY0): Skips the next instruction if VX does not equal VY (Usually the next instruction is a jump to skip a code block)
+void chip8::op9XY0(const instruction &ins)
+{
+    if (_v[ins.x] != _v[ins.y])
+    {
+        // Skip next instruction
+        _programCounter += 4;
+    }
+    else
+    {
+        // Move to next instruction
+        _programCounter += 2;
+    }
+}
+
+// ANNN (0xANNN): Sets index register to the address NNN
+void chip8::opANNN(const instruction &ins)
+{
+    _indexRegister = ins.nnn;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// BNNN (0xBNNN): Jumps to the address NNN plus V0
+template <typename QUIRKS>
+void chip8::opBNNN(const instruction &ins)
+{
+    // SUPER-CHIP reads it as BXNN and adds VX instead
+    _programCounter = ins.nnn + _v[QUIRKS::JUMP_USES_VX ? ins.x : 0];
+}
+
+// CXNN (0xCXNN): Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN
+void chip8::opCXNN(const instruction &ins)
+{
+    // "& 0xFF" gives a random number between 0 and 255 (0xFF)
+    _v[ins.x] = ins.nn & (pcg32(_random) & 0xFF);
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// DXYN (0xDXYN): Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
+// Each row of 8 pixels is read as bit-coded starting from memory location I; I value does not change after the execution of this instruction.
+// As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that does not happen
+template <typename QUIRKS>
+void chip8::opDXYN(const instruction &ins)
+{
+    // The starting position wraps around the screen
+    const unsigned int x = _v[ins.x] & 63;
+    const unsigned int y = _v[ins.y] & 31;
+
+    // Any bit set in both the screen and a sprite row is a pixel that gets flipped off
+    uint64_t collision = 0;
+
+    for (int row = 0; row < ins.n; ++row)
+    {
+        // Clipped sprites stop at the bottom edge
+        if constexpr (QUIRKS::CLIP_SPRITES)
+        {
+            if (y + row > 31)
+            {
+                break;
+            }
+        }
+
+        // Put the 8 pixel sprite row at the left edge of a screen row, then move it across to X,
+        // rotating wraps the pixels past the right edge around and shifting drops them
+        const uint64_t bits = (uint64_t)_memory[(_indexRegister + row) & 0x0FFF] << 56;
+        const uint64_t sprite = QUIRKS::CLIP_SPRITES ? bits >> x : rotateRight(bits, x);
+        uint64_t &line = _gfx[(y + row) & 31];
+
+        collision |= line & sprite;
+        line ^= sprite;
+        _dirty[(y + row) & 31] |= sprite;
+    }
+
+    _v[0xF] = collision != 0;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// EX9E (0xEX9E): Skips the next instruction if the key stored in VX is pressed (Usually the next instruction is a jump to skip a code block)
+void chip8::opEX9E(const instruction &ins)
+{
+    // Skip the next instruction if the key is down
+    _programCounter += (_keys >> (_v[ins.x] & 0xF)) & 1 ? 4 : 2;
+}
+
+// EXA1 (0xEXA1): Skips the next instruction if the key stored in VX is not pressed (Usually the next instruction is a jump to skip a code block)
+void chip8::opEXA1(const instruction &ins)
+{
+    // Skip the next instruction if the key is up
+    _programCounter += (_keys >> (_v[ins.x] & 0xF)) & 1 ? 2 : 4;
+}
+
+// FX07 (0xFX07): Sets VX to the value of the delay timer
+void chip8::opFX07(const instruction &ins)
+{
+    _v[ins.x] = _delayTimer;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX0A (0xFX0A): A key press is awaited, and then stored in VX (Blocking Operation. All instruction halted until next key event)
+void chip8::opFX0A(const instruction &)
+{
+    // Block without moving on, the next key press stores the key in VX and moves to the next instruction
+    _waitingForKey = true;
+}
+
+// FX15 (0xFX15): Sets the delay timer to VX
+void chip8::opFX15(const instruction &ins)
+{
+    _delayTimer = _v[ins.x];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX18 (0xFX18): Sets the sound timer to VX
+void chip8::opFX18(const instruction &ins)
+{
+    setSoundTimer(_v[ins.x]);
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX1E (0xFX1E): Adds VX to I. VF is not affected
+void chip8::opFX1E(const instruction &ins)
+{
+    // VF is set to 1 if range overflows (index register + VX > 0xFFF)
+    if (_indexRegister + _v[ins.x] > 0xFFF)
+    {
+        _v[0xF] = 1;
+    }
+    else
+    {
+        _v[0xF] = 0;
+    }
+    _indexRegister += _v[ins.x];
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX29 (0xFX29): Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font
+void chip8::opFX29(const instruction &ins)
+{
+    // The font starts at address 0, 5 bytes per character
+    _indexRegister = (_v[ins.x] & 0xF) * 5;
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX33 (0xFX33): Stores the binary-coded decimal representation of VX, with the most significant of three digits at the address in I,
+// the middle digit at I plus 1, and the least significant digit at I plus 2
+// (In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2)
+void chip8::opFX33(const instruction &ins)
+{
+    writeMemory(_indexRegister, _v[ins.x] / 100);
+    writeMemory(_indexRegister + 1, (_v[ins.x] / 10) % 10);
+    writeMemory(_indexRegister + 2, _v[ins.x] % 10);
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX55 (0xFX55): Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
+template <typename QUIRKS>
+void chip8::opFX55(const instruction &ins)
+{
+    for (int i = 0; i <= ins.x; ++i)
+    {
+        writeMemory(_indexRegister + i, _v[i]);
+    }
+
+    // The VIP moved I along as it went
+    if constexpr (QUIRKS::LOAD_STORE_ADVANCES_I)
+    {
+        _indexRegister += ins.x + 1;
+    }
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+// FX65 (0xFX65): Fills V0 to VX (including VX) with values from memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified
+template <typename QUIRKS>
+void chip8::opFX65(const instruction &ins)
+{
+    for (int i = 0; i <= ins.x; ++i)
+    {
+        _v[i] = _memory[(_indexRegister + i) & 0x0FFF];
+    }
+
+    // The VIP moved I along as it went
+    if constexpr (QUIRKS::LOAD_STORE_ADVANCES_I)
+    {
+        _indexRegister += ins.x + 1;
+    }
+
+    // Move to next instruction
+    _programCounter += 2;
+}
+
+/// Halt on an opcode no Chip 8 has, reporting it once
+/// The program counter stays on it, so badOpcode() can tell a host which one it was.
+void chip8::opBad(const instruction &)
+{
+    _halted = true;
+    fprintf(stderr, "Bad opcode 0x%04X at 0x%03X, halted\n", badOpcode(), _programCounter);
+}
+
+// Superinstructions, see fuse()
+// Each gets the decode cache record of its first instruction, the rest follow it in the cache.
+// Like every handler they leave counting the first instruction to the caller.
+
+// ANNN DXYN: Points I at a sprite and draws it
+template <typename QUIRKS>
+void chip8::opANNNDXYN(const instruction &ins)
+{
+    _indexRegister = ins.nnn;
+    _programCounter += 2;
+
+    opDXYN<QUIRKS>((&ins)[1]);
+    ++_instructions;
+}
+
+// 6XNN 6YNN: Sets two registers, usually where to draw a sprite
+void chip8::op6XNN6YNN(const instruction &ins)
+{
+    const instruction &second = (&ins)[1];
+    _v[ins.x] = ins.nn;
+    _v[second.x] = second.nn;
+
+    _programCounter += 4;
+    ++_instructions;
+}
+
+// 7XNN 3XNN 1NNN: Adds to VX and jumps back until VX reaches NN
+void chip8::op7XNN3XNN1NNN(const instruction &ins)
+{
+    _v[ins.x] += ins.nn;
+
+    if (_v[ins.x] == (&ins)[1].nn)
+    {
+        // The jump is skipped, so only two instructions ran
+        _programCounter += 6;
+        ++_instructions;
     }
     else
     {
-        for (int i = 0; i < programSize; ++i)
+        _programCounter = (&ins)[2].nnn;
+        _instructions += 2;
+    }
+}
+
+bool chip8::drawFlag()
+{
+    for (int y = 0; y < 32; ++y)
+    {
+        if (_dirty[y] != 0)
         {
-            _memory[i + PROGRAM_START_ADDRESS] = buffer[i];
+            return true;
         }
     }
+    return false;
+}
 
-    // Close file and free buffer
+/// Setting the draw flag marks the whole screen dirty, clearing it forgets every dirty region
+void chip8::setDrawFlag(const bool flag)
+{
+    for (int y = 0; y < 32; ++y)
+    {
+        _dirty[y] = flag ? ~0ULL : 0;
+    }
+}
+
+/// Get the regions of the screen that changed since the last call, and start tracking afresh
+std::vector<chip8::rect> chip8::dirtyRegions()
+{
+    const std::vector<rect> regions = changedRegions(_dirty);
+    setDrawFlag(false);
+    return regions;
+}
+
+/// Turn 32 rows of changed pixel masks, laid out like the screen, into rectangles
+/// Consecutive changed rows are merged into one rectangle spanning all of their changed columns
+std::vector<chip8::rect> chip8::changedRegions(const uint64_t *changed)
+{
+    std::vector<rect> regions;
+
+    int y = 0;
+    while (y < 32)
+    {
+        if (changed[y] == 0)
+        {
+            ++y;
+            continue;
+        }
+
+        // Grow the run of changed rows, collecting the columns changed in any of them
+        const int top = y;
+        uint64_t columns = 0;
+        while (y < 32 && changed[y] != 0)
+        {
+            columns |= changed[y];
+            ++y;
+        }
+
+        // Leftmost pixel is the most significant bit
+        int left = 0;
+        while (((columns >> (63 - left)) & 1) == 0)
+        {
+            ++left;
+        }
+        int right = 63;
+        while (((columns >> (63 - right)) & 1) == 0)
+        {
+            --right;
+        }
+
+        rect region;
+        region.x = left;
+        region.y = top;
+        region.width = right - left + 1;
+        region.height = y - top;
+        regions.push_back(region);
+    }
+
+    return regions;
+}
+
+/// Load a program file
+/// The file is mapped rather than read, so its bytes are copied once, straight into memory.
+bool chip8::load(const char *path)
+{
+#ifdef _WIN32
+    FILE *program = fopen(path, "rb");
+    if (program == nullptr)
+    {
+        fprintf(stderr, "Could not open program %s\n", path);
+        return false;
+    }
+
+    // Check size of program
+    fseek(program, 0, SEEK_END);
+    const long programSize = ftell(program);
+    rewind(program);
+    if (programSize < 0 || programSize > MEMORY_SIZE - PROGRAM_START_ADDRESS)
+    {
+        fprintf(stderr, "Program %s is too big\n", path);
+        fclose(program);
+        return false;
+    }
+
+    unsigned char buffer[MEMORY_SIZE - PROGRAM_START_ADDRESS];
+    const bool loaded = fread(buffer, 1, programSize, program) == (size_t)programSize && load(buffer, programSize);
     fclose(program);
-    free(buffer);
+    return loaded;
+#else
+    const int program = open(path, O_RDONLY);
+    if (program < 0)
+    {
+        fprintf(stderr, "Could not open program %s\n", path);
+        return false;
+    }
+
+    // Check size of program before mapping any of it
+    struct stat info;
+    if (fstat(program, &info) != 0 || info.st_size > MEMORY_SIZE - PROGRAM_START_ADDRESS)
+    {
+        fprintf(stderr, "Program %s is too big\n", path);
+        close(program);
+        return false;
+    }
+
+    // An empty file can't be mapped, but is a valid if dull program
+    if (info.st_size == 0)
+    {
+        close(program);
+        return load((const unsigned char *)"", 0);
+    }
+
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, program, 0);
+    close(program);
+    if (mapped == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map program %s\n", path);
+        return false;
+    }
+
+    const bool loaded = load((const unsigned char *)mapped, info.st_size);
+    munmap(mapped, info.st_size);
+    return loaded;
+#endif
+}
+
+/// Load a program that is already in memory, such as one generated by the host
+bool chip8::load(const unsigned char *program, const size_t size)
+{
+    // Check if we can fit the program into our memory
+    // and if we can, load the buffer into memory
+    if (size > MEMORY_SIZE - PROGRAM_START_ADDRESS)
+    {
+        fputs("Program is too big\n", stderr);
+        return false;
+    }
+
+    ownMemory();
+    memcpy(_memory + PROGRAM_START_ADDRESS, program, size);
+
+    // Decode the whole program once up front
+    refreshDecodeCache();
+    if (_jit)
+    {
+        _jit->flush();
+    }
+
+    // Use the program's ahead of time translation if one was linked in
+    const aot::program *translated = aot::find(program, size);
+    _aot.reset(translated != nullptr ? new aot(*translated) : nullptr);
 
     return true;
 }
\ No newline at end of file
@@ -1,4 +1,3 @@
-
 /// Chip 8 Emulator class
 /// The bulk of the emulation happens in this class
 ///
@@ -10,25 +9,247 @@
 #ifndef CHIP8_H
 #define CHIP8_H
 
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "input.h"
+#include "quirks.h"
+#ifdef CHIP8_PROFILE
+#include "profiler.h"
+#endif
+
+class aot;
+class jit;
+
+/// Instructions per second run by chip8::runFrame() unless told otherwise
+const unsigned int DEFAULT_INSTRUCTION_RATE = 700;
+
 class chip8
 {
+    friend class aot;
+    friend class jit;
+
 public:
+    /// How cycle() turns the opcode at the program counter into something it can execute
+    enum class dispatch
+    {
+        /// Fetch both bytes and run the nested opcode switch on every instruction (reference path)
+        SWITCH,
+        /// Execute records pre-decoded by load(), only re-decoding bytes written by FX33/FX55
+        /// A few common sequences of two or three instructions run as one record, see fuse()
+        DECODE_CACHE,
+        /// Run native code translated from basic blocks, interpreting whatever the translator does not handle
+        JIT,
+        /// Fetch every instruction like SWITCH, but find its handler in a table indexed by the whole opcode
+        /// and jump from the end of each handler straight to the next one
+        /// Needs GCC or Clang, other compilers and profiling builds run it like DECODE_CACHE without fused records
+        THREADED,
+        /// Call the functions the translate tool compiled from the loaded ROM, interpreting like
+        /// DECODE_CACHE wherever there are none (see aot.h)
+        AOT
+    };
+
+    /// A region of the screen in pixels
+    struct rect
+    {
+        unsigned char x;
+        unsigned char y;
+        unsigned char width;
+        unsigned char height;
+    };
+
+    /// The buzzer turning on or off, stamped with the number of instructions run before it did
+    struct soundEvent
+    {
+        uint64_t instruction;
+        bool on;
+    };
+
+    /// The whole 4KB of Chip 8 memory, shared copy-on-write between machines, forks and snapshots
+    struct memoryPage
+    {
+        unsigned char bytes[4096];
+    };
+
+    /// Everything needed to put a machine back exactly where it was
+    /// Memory is shared with the machine rather than copied, so taking a snapshot is cheap
+    struct state
+    {
+        std::shared_ptr<const memoryPage> memory;
+        unsigned char v[16];
+        unsigned short indexRegister;
+        unsigned short programCounter;
+        uint64_t gfx[32];
+        unsigned char delayTimer;
+        unsigned char soundTimer;
+        unsigned short stack[16];
+        unsigned short stackPointer;
+        unsigned short keys;
+        bool waitingForKey;
+        bool halted;
+        uint64_t random;
+        uint64_t instructions;
+        uint64_t frames;
+
+        /// Where runFrame() is in spreading the instruction rate over frames, see _frameStart
+        uint64_t frameStart;
+        uint64_t frame;
+    };
+
     chip8();
     ~chip8();
 
     void init();
     void cycle();
+    void tickTimers();
+    void runFrame();
+    void setInstructionRate(const unsigned int perSecond);
     bool load(const char *path);
+    bool load(const unsigned char *program, const size_t size);
     bool drawFlag();
     void setDrawFlag(const bool flag);
+    void setDispatch(const dispatch mode);
+    void setQuirks(const quirks preset);
+    void expandGfx(unsigned char *pixels) const;
+    const uint64_t *gfx() const;
+    std::vector<rect> dirtyRegions();
+    static std::vector<rect> changedRegions(const uint64_t *changed);
+    uint64_t instructions() const;
+    uint64_t frames() const;
+    uint64_t stateHash() const;
+    uint64_t gfxHash() const;
+    uint64_t vHash() const;
+    uint64_t memoryHash() const;
+    void seed(const uint64_t value);
+    void setKey(const unsigned char key, const bool pressed);
+    bool waitingForKey() const;
+    bool halted() const;
+    unsigned short badOpcode() const;
+    void setInputQueue(keyQueue *queue);
+    void pollInput();
+    uint64_t takeInputTime();
+    bool parked() const;
+    void setSoundLog(std::vector<soundEvent> *log);
+    bool buzzing() const;
+    state snapshot() const;
+    void restore(const state &saved);
+    std::unique_ptr<chip8> fork() const;
+
+#ifdef CHIP8_PROFILE
+    /// Everything executed since init()
+    const profiler &profile() const;
+#endif
 
 private:
+    struct instruction;
+
+    /// Every opcode is executed by one of these member functions
+    typedef void (chip8::*handler)(const instruction &);
+
+    /// A pre-decoded opcode
+    /// Holds the handler to execute along with every operand field it could need,
+    /// so the handler never has to mask and shift the raw opcode itself
+    struct instruction
+    {
+        handler execute;
+        unsigned char x;
+        unsigned char y;
+        unsigned char n;
+        unsigned char nn;
+        unsigned short nnn;
+    };
+
+    /// Sequence of instructions starting at an address that run as a single record
+    /// execute is handed the first instruction's record in _decodeCache and reads the ones after it
+    /// from the cache too. length is the most instructions it can run, 0 where nothing was fused.
+    struct superinstruction
+    {
+        handler execute;
+        unsigned char length;
+    };
+
+    /// Every decoded record and superinstruction, shared copy-on-write between a machine and its forks like memoryPage
+    /// One entry for every even address in program space (0x200 - 0xFFE), index with (address - 0x200) >> 1
+    struct decodedPage
+    {
+        instruction records[(4096 - 0x200) / 2];
+        superinstruction fused[(4096 - 0x200) / 2];
+    };
+
+    chip8(const std::shared_ptr<memoryPage> &memory, const std::shared_ptr<decodedPage> &decoded);
+
+    instruction decode(const unsigned short opcode) const;
+    template <typename QUIRKS>
+    instruction decodeWith(const unsigned short opcode) const;
+    void refreshDecodeCache();
+    void redecode(const unsigned short address);
+    void fuse(const int index);
+    void writeMemory(const unsigned short address, const unsigned char value);
+    void ownMemory();
+    void ownDecoded();
+    void resetFrames();
+    int idleLoop() const;
+    void step(const uint64_t budget);
+    template <typename QUIRKS>
+    void runThreaded(const uint64_t budget);
+    void setSoundTimer(const unsigned char value);
+
+    void op00E0(const instruction &ins);
+    void op00EE(const instruction &ins);
+    void op1NNN(const instruction &ins);
+    void op2NNN(const instruction &ins);
+    void op3XNN(const instruction &ins);
+    void op4XNN(const instruction &ins);
+    void op5XY0(const instruction &ins);
+    void op6XNN(const instruction &ins);
+    void op7XNN(const instruction &ins);
+    void op8XY0(const instruction &ins);
+    void op8XY1(const instruction &ins);
+    void op8XY2(const instruction &ins);
+    void op8XY3(const instruction &ins);
+    void op8XY4(const instruction &ins);
+    void op8XY5(const instruction &ins);
+    template <typename QUIRKS>
+    void op8XY6(const instruction &ins);
+    void op8XY7(const instruction &ins);
+    template <typename QUIRKS>
+    void op8XYE(const instruction &ins);
+    void op9XY0(const instruction &ins);
+    void opANNN(const instruction &ins);
+    template <typename QUIRKS>
+    void opBNNN(const instruction &ins);
+    void opCXNN(const instruction &ins);
+    template <typename QUIRKS>
+    void opDXYN(const instruction &ins);
+    void opEX9E(const instruction &ins);
+    void opEXA1(const instruction &ins);
+    void opFX07(const instruction &ins);
+    void opFX0A(const instruction &ins);
+    void opFX15(const instruction &ins);
+    void opFX18(const instruction &ins);
+    void opFX1E(const instruction &ins);
+    void opFX29(const instruction &ins);
+    void opFX33(const instruction &ins);
+    template <typename QUIRKS>
+    void opFX55(const instruction &ins);
+    template <typename QUIRKS>
+    void opFX65(const instruction &ins);
+    void opBad(const instruction &ins);
+
+    template <typename QUIRKS>
+    void opANNNDXYN(const instruction &ins);
+    void op6XNN6YNN(const instruction &ins);
+    void op7XNN3XNN1NNN(const instruction &ins);
+
     /// The Chip 8 has 35 opcodes which are all two bytes long.
     /// To store the current opcode, an unsigned short has length of two bytes fitting our needs
     unsigned short _opcode;
 
     /// The Chip 8 has 4KB of memory
-    unsigned char _memory[4096];
+    /// _memory points into _memoryPage, which may be shared with forks and snapshots until either side writes to it
+    std::shared_ptr<memoryPage> _memoryPage;
+    unsigned char *_memory;
 
     /// The Chip 8 has 15 8-bit general purpose registers named V0, V1...VE
     /// The 16th register is used for the 'carry flag'
@@ -43,24 +264,115 @@ private:
 
     /// The graphics of the Chip 8 are black and white
     /// and the screen has a total of 2048 pixels (64 x 32 resolution)
-    /// This is implemented as an array that holds the pixel state of either 0 or 1
-    unsigned char _gfx[64 * 32];
+    /// This is implemented as one 64-bit word per row, the most significant bit is the leftmost pixel
+    /// so a sprite row can be drawn with a single shift and XOR
+    uint64_t _gfx[32];
 
     /// Timer registers that count at 60hz
 
     /// When set above zero, they will count down to zero
     unsigned char _delayTimer;
 
-    /// The system's buzzer sounds whenever the sound timer reaches zero
+    /// The system's buzzer sounds for as long as the sound timer is above zero
     unsigned char _soundTimer;
 
+    /// Where the buzzer turning on and off is recorded, if anywhere
+    std::vector<soundEvent> *_soundLog;
+
     unsigned short _stack[16];
     unsigned short _stackPointer;
 
-    /// Chip 8 has a HEX based keypad (0x0 - 0xF)
-    unsigned char _key[16];
+    /// Chip 8 has a HEX based keypad (0x0 - 0xF), bit K is set while key K is down
+    unsigned short _keys;
+
+    /// Set while an FX0A at the program counter waits for a key press, which completes it in setKey()
+    bool _waitingForKey;
+
+    /// Set once a bad opcode is reached, the machine stays on it and runs nothing more until init()
+    bool _halted;
+
+    /// Where key events from the host come from, if anywhere
+    keyQueue *_input;
+
+    /// Time stamp of the oldest key event applied since takeInputTime(), 0 if there was none
+    uint64_t _inputTime;
+
+    /// Pixels changed since the host last asked for dirty regions, one mask per row laid out like _gfx
+    /// The draw flag is simply whether any of these are set
+    uint64_t _dirty[32];
+
+    /// Random number generator state used by CXNN, seeded per machine so runs can be reproduced
+    uint64_t _random;
+
+    /// Number of instructions executed since init()
+    uint64_t _instructions;
+
+    /// Number of frames run by runFrame() since init(), frames spent waiting for a key included
+    uint64_t _frames;
 
-    bool _drawFlag;
+    /// Instructions per second of emulated time, 0 for as many as the host can run
+    unsigned int _instructionRate;
+
+    /// Frames run by runFrame() since _frameStart instructions, used to work out each frame's instruction budget
+    uint64_t _frameStart;
+    uint64_t _frame;
+
+    /// Which decoder cycle() uses
+    dispatch _dispatch;
+
+    /// Interpreter whose quirks the program expects, and decodeWith() instantiated for its policy
+    quirks _quirks;
+    instruction (chip8::*_decoder)(const unsigned short opcode) const;
+    void (chip8::*_threaded)(const uint64_t budget);
+
+    /// One pre-decoded instruction for every even address in program space, and the superinstruction starting there
+    /// Both point into _decodedPage, which may be shared with forks until either side decodes something again
+    std::shared_ptr<decodedPage> _decodedPage;
+    instruction *_decodeCache;
+    superinstruction *_superinstructions;
+
+    /// Translated code cache, only created once the JIT dispatch is selected
+    std::unique_ptr<jit> _jit;
+
+    /// Instruction count at which a JIT machine without a code cache creates one, see fork()
+    uint64_t _jitFrom;
+
+    /// Blocks translated ahead of time from the loaded ROM, if it is one that was translated
+    std::unique_ptr<aot> _aot;
+
+#ifdef CHIP8_PROFILE
+    profiler _profiler;
+#endif
 };
 
-#endif
\ No newline at end of file
+/// Look up a dispatch mode by the name the tools take on the command line, false if there is no such mode
+inline bool parseDispatch(const char *name, chip8::dispatch &mode)
+{
+    if (strcmp(name, "switch") == 0)
+    {
+        mode = chip8::dispatch::SWITCH;
+    }
+    else if (strcmp(name, "cache") == 0)
+    {
+        mode = chip8::dispatch::DECODE_CACHE;
+    }
+    else if (strcmp(name, "jit") == 0)
+    {
+        mode = chip8::dispatch::JIT;
+    }
+    else if (strcmp(name, "threaded") == 0)
+    {
+        mode = chip8::dispatch::THREADED;
+    }
+    else if (strcmp(name, "aot") == 0)
+    {
+        mode = chip8::dispatch::AOT;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/// Delta encoding shared by the rewind buffer and the frame recorder
+/// A delta is the XOR of two equally sized blocks, stored as pairs of (run of zero bytes, run of
+/// literal bytes) with each run length as a little endian base 128 varint. Blocks that mostly
+/// match encode to a few bytes, and applying a delta to either block gives the other one.
+///
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <vector>
+
+/// Append a length as a little endian base 128 varint
+inline void putLength(std::vector<unsigned char> &out, size_t length)
+{
+    while (length >= 0x80)
+    {
+        out.push_back((length & 0x7F) | 0x80);
+        length >>= 7;
+    }
+    out.push_back(length);
+}
+
+/// Read a length without going past end, returns false if it doesn't fit
+inline bool getLength(const unsigned char *&in, const unsigned char *end, size_t &length)
+{
+    length = 0;
+    for (unsigned int shift = 0; in < end && shift < sizeof(size_t) * 8; shift += 7)
+    {
+        const unsigned char byte = *in++;
+        length |= (size_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Append the encoded a XOR b to out
+inline void encodeDelta(const unsigned char *a, const unsigned char *b, const size_t size, std::vector<unsigned char> &out)
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        const size_t zeroStart = i;
+        while (i < size && a[i] == b[i])
+        {
+            ++i;
+        }
+        const size_t literalStart = i;
+        while (i < size && a[i] != b[i])
+        {
+            ++i;
+        }
+
+        putLength(out, literalStart - zeroStart);
+        putLength(out, i - literalStart);
+        for (size_t j = literalStart; j < i; ++j)
+        {
+            out.push_back(a[j] ^ b[j]);
+        }
+    }
+}
+
+/// XOR an encoded delta into a block of size bytes, turning one side of the delta into the other
+/// Returns false, leaving block untouched, if the delta runs past its end or past the block.
+inline bool applyDelta(const unsigned char *in, const unsigned char *end, unsigned char *block, const size_t size)
+{
+    // Check every run first, a delta that turns out bad half way must not have changed anything
+    const unsigned char *check = in;
+    size_t offset = 0;
+    while (check < end)
+    {
+        size_t zeros;
+        size_t literals;
+        if (!getLength(check, end, zeros) || !getLength(check, end, literals) ||
+            zeros > size - offset || literals > size - offset - zeros || literals > (size_t)(end - check))
+        {
+            return false;
+        }
+        offset += zeros + literals;
+        check += literals;
+    }
+
+    while (in < end)
+    {
+        size_t zeros;
+        size_t literals;
+        getLength(in, end, zeros);
+        getLength(in, end, literals);
+        block += zeros;
+        while (literals-- > 0)
+        {
+            *block++ ^= *in++;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,312 @@
+/// Frame stream to animated GIF converter
+/// Turns a recording made by frameRecorder (see batch -v) into a looping GIF at its original speed.
+///
+/// Usage: framegif <stream> <gif> [-s scale] [-p offRGB,onRGB]
+///
+/// Only the part of the screen that changed goes into each GIF frame. Browsers slow down frames
+/// shorter than 2/100 of a second, so screens that stay up for less are merged into the next one.
+///
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "framestream.h"
+
+/// GIF delays are in hundredths of a second
+const uint64_t SHORTEST_DELAY = 2;
+
+const unsigned int DEFAULT_SCALE = 4;
+
+/// Colour indices, the colour table has four entries as the smallest LZW code size is 2 bits
+const unsigned char OFF = 0;
+const unsigned char ON = 1;
+const int MIN_CODE_SIZE = 2;
+
+/// Packs LZW codes least significant bit first into the 255 byte sub-blocks GIF stores image data in
+class codeWriter
+{
+public:
+    codeWriter(FILE *file)
+        : _file(file), _bits(0), _count(0), _size(0)
+    {
+    }
+
+    void write(const unsigned int code, const int size)
+    {
+        _bits |= (uint32_t)code << _count;
+        _count += size;
+        while (_count >= 8)
+        {
+            put(_bits & 0xFF);
+            _bits >>= 8;
+            _count -= 8;
+        }
+    }
+
+    /// Write out the last partial byte and the block terminator
+    void finish()
+    {
+        if (_count > 0)
+        {
+            put(_bits & 0xFF);
+        }
+        if (_size > 0)
+        {
+            fputc(_size, _file);
+            fwrite(_block, 1, _size, _file);
+        }
+        fputc(0, _file);
+    }
+
+private:
+    void put(const unsigned char byte)
+    {
+        _block[_size++] = byte;
+        if (_size == 255)
+        {
+            fputc(_size, _file);
+            fwrite(_block, 1, _size, _file);
+            _size = 0;
+        }
+    }
+
+    FILE *_file;
+    uint32_t _bits;
+    int _count;
+    unsigned char _block[255];
+    int _size;
+};
+
+/// LZW compress colour indices the way GIF expects, with a clear code whenever the table fills up
+void compress(FILE *file, const std::vector<unsigned char> &pixels)
+{
+    const unsigned int clear = 1 << MIN_CODE_SIZE;
+    const unsigned int endOfImage = clear + 1;
+
+    // Strings are a prefix code plus one more index, children[code][index] is the code for that
+    std::vector<uint16_t> children(4096 * 4);
+    unsigned int last = endOfImage;
+    int size = MIN_CODE_SIZE + 1;
+
+    fputc(MIN_CODE_SIZE, file);
+    codeWriter codes(file);
+    codes.write(clear, size);
+
+    unsigned int current = pixels[0];
+    for (size_t i = 1; i < pixels.size(); ++i)
+    {
+        const unsigned char next = pixels[i];
+        if (children[current * 4 + next] != 0)
+        {
+            current = children[current * 4 + next];
+            continue;
+        }
+
+        codes.write(current, size);
+        children[current * 4 + next] = ++last;
+        if (last >= (1u << size))
+        {
+            ++size;
+        }
+
+        // 12 bits is as wide as codes go, start over with a fresh table
+        if (last == 4095)
+        {
+            codes.write(clear, size);
+            std::fill(children.begin(), children.end(), 0);
+            last = endOfImage;
+            size = MIN_CODE_SIZE + 1;
+        }
+        current = next;
+    }
+
+    codes.write(current, size);
+    codes.write(endOfImage, size);
+    codes.finish();
+}
+
+void put16(FILE *file, const unsigned int value)
+{
+    fputc(value & 0xFF, file);
+    fputc(value >> 8, file);
+}
+
+/// Add one GIF frame covering whatever differs between shown and screen
+void writeFrame(FILE *file, const uint64_t *shown, const uint64_t *screen, const unsigned int scale, const uint64_t delay)
+{
+    // Bounding box of the changed pixels, a frame with no changes still needs one pixel to carry its delay
+    int top = 32;
+    int bottom = 0;
+    uint64_t columns = 0;
+    for (int y = 0; y < 32; ++y)
+    {
+        const uint64_t changed = shown[y] ^ screen[y];
+        if (changed != 0)
+        {
+            top = y < top ? y : top;
+            bottom = y;
+            columns |= changed;
+        }
+    }
+    if (columns == 0)
+    {
+        top = 0;
+        columns = 1ULL << 63;
+    }
+
+    // Leftmost pixel is the most significant bit
+    int left = 0;
+    while (((columns >> (63 - left)) & 1) == 0)
+    {
+        ++left;
+    }
+    int right = 63;
+    while (((columns >> (63 - right)) & 1) == 0)
+    {
+        --right;
+    }
+
+    // Graphic control extension: leave the frame in place for the next one to draw over
+    fputc(0x21, file);
+    fputc(0xF9, file);
+    fputc(4, file);
+    fputc(1 << 2, file);
+    put16(file, delay > 0xFFFF ? 0xFFFF : (unsigned int)delay);
+    fputc(0, file);
+    fputc(0, file);
+
+    const unsigned int width = (right - left + 1) * scale;
+    const unsigned int height = (bottom - top + 1) * scale;
+    fputc(0x2C, file);
+    put16(file, left * scale);
+    put16(file, top * scale);
+    put16(file, width);
+    put16(file, height);
+    fputc(0, file);
+
+    std::vector<unsigned char> pixels;
+    pixels.reserve(width * height);
+    for (int y = top; y <= bottom; ++y)
+    {
+        for (unsigned int line = 0; line < scale; ++line)
+        {
+            for (int x = left; x <= right; ++x)
+            {
+                pixels.insert(pixels.end(), scale, (screen[y] >> (63 - x)) & 1 ? ON : OFF);
+            }
+        }
+    }
+    compress(file, pixels);
+}
+
+/// Time a frame number is shown at in hundredths of a second
+uint64_t centiseconds(const uint64_t frame)
+{
+    return (frame * 100 + 30) / 60;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fputs("Usage: framegif <stream> <gif> [-s scale] [-p offRGB,onRGB]\n", stderr);
+        return 1;
+    }
+
+    unsigned int scale = DEFAULT_SCALE;
+    unsigned int off = 0x000000;
+    unsigned int on = 0xFFFFFF;
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            scale = atoi(argv[i + 1]);
+            scale = scale > 0 ? scale : 1;
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            sscanf(argv[i + 1], "%x,%x", &off, &on);
+        }
+    }
+
+    frameStream stream;
+    if (!stream.open(argv[1]))
+    {
+        return 1;
+    }
+
+    FILE *file = fopen(argv[2], "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[2]);
+        return 1;
+    }
+
+    // Header, logical screen with a four colour global table
+    fwrite("GIF89a", 1, 6, file);
+    put16(file, 64 * scale);
+    put16(file, 32 * scale);
+    fputc(0x80 | (1 << 4) | 1, file);
+    fputc(OFF, file);
+    fputc(0, file);
+    const unsigned int palette[4] = {off, on, off, off};
+    for (int i = 0; i < 4; ++i)
+    {
+        fputc(palette[i] >> 16 & 0xFF, file);
+        fputc(palette[i] >> 8 & 0xFF, file);
+        fputc(palette[i] & 0xFF, file);
+    }
+
+    // Loop forever
+    fputc(0x21, file);
+    fputc(0xFF, file);
+    fputc(11, file);
+    fwrite("NETSCAPE2.0", 1, 11, file);
+    fputc(3, file);
+    fputc(1, file);
+    put16(file, 0);
+    fputc(0, file);
+
+    // A screen is only written once the next one says how long it stayed up
+    uint64_t shown[32] = {};
+    uint64_t pending[32] = {};
+    uint64_t pendingStart = 0;
+    uint64_t written = 0;
+
+    bool first = true;
+    uint64_t frame;
+    uint64_t screen[32];
+    while (stream.next(frame, screen))
+    {
+        const uint64_t start = centiseconds(frame);
+        if (first || start - pendingStart >= SHORTEST_DELAY)
+        {
+            // The blank screen before the first change is only worth a frame if it stayed up
+            if (!first || start > 0)
+            {
+                writeFrame(file, shown, pending, scale, start - pendingStart);
+                memcpy(shown, pending, sizeof(shown));
+                ++written;
+            }
+            pendingStart = start;
+        }
+        memcpy(pending, screen, sizeof(pending));
+        first = false;
+    }
+
+    const uint64_t end = centiseconds(stream.end());
+    writeFrame(file, shown, pending, scale, end > pendingStart + SHORTEST_DELAY ? end - pendingStart : SHORTEST_DELAY);
+    ++written;
+
+    fputc(0x3B, file);
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(stderr, "%" PRIu64 " frames written\n", written);
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include "framestream.h"
+#include <string.h>
+#include "delta.h"
+#include "hash.h"
+
+namespace
+{
+    const char MAGIC[4] = {'C', '8', 'F', 'S'};
+    const unsigned char VERSION = 1;
+
+    enum recordType : unsigned char
+    {
+        END = 0,
+        DELTA = 1,
+        REPEAT = 2
+    };
+
+    /// Bytes in a screen
+    const size_t SCREEN_SIZE = 32 * 8;
+
+    /// Distinct screens a REPEAT can refer back to
+    const uint64_t HISTORY = 1024;
+
+    /// Buffered bytes written out at once
+    const size_t FLUSH_SIZE = 64 * 1024;
+
+    /// Lay out a screen as bytes, independent of the host's byte order
+    void pack(const uint64_t *gfx, unsigned char *out)
+    {
+        for (int y = 0; y < 32; ++y)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                *out++ = gfx[y] >> (56 - i * 8);
+            }
+        }
+    }
+
+    void unpack(const unsigned char *in, uint64_t *gfx)
+    {
+        for (int y = 0; y < 32; ++y)
+        {
+            uint64_t row = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                row = row << 8 | *in++;
+            }
+            gfx[y] = row;
+        }
+    }
+}
+
+frameRecorder::frameRecorder()
+    : _file(nullptr), _failed(false), _lastFrame(0), _current(SCREEN_SIZE), _history(HISTORY * SCREEN_SIZE), _historyHashes(HISTORY), _distinct(0), _screens(0), _repeats(0)
+{
+}
+
+frameRecorder::~frameRecorder()
+{
+    close(_lastFrame);
+}
+
+bool frameRecorder::open(const char *path)
+{
+    close(_lastFrame);
+
+    _file = fopen(path, "wb");
+    if (_file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    // Machines start with a blank screen, which isn't recorded
+    _failed = false;
+    _lastFrame = 0;
+    memset(_current.data(), 0, SCREEN_SIZE);
+    _seen.clear();
+    _distinct = 0;
+    _screens = 0;
+    _repeats = 0;
+
+    _buffer.assign(MAGIC, MAGIC + sizeof(MAGIC));
+    _buffer.push_back(VERSION);
+    return true;
+}
+
+void frameRecorder::record(const uint64_t *gfx, const uint64_t frame)
+{
+    if (_file == nullptr)
+    {
+        return;
+    }
+
+    unsigned char screen[SCREEN_SIZE];
+    pack(gfx, screen);
+
+    // Programs often redraw a sprite in the same place, which sets the draw flag without changing anything
+    if (memcmp(screen, _current.data(), SCREEN_SIZE) == 0)
+    {
+        return;
+    }
+
+    const uint64_t hash = fnv1a(screen, SCREEN_SIZE);
+    const std::unordered_map<uint64_t, uint64_t>::iterator seen = _seen.find(hash);
+    if (seen != _seen.end() && _distinct - seen->second <= HISTORY &&
+        memcmp(&_history[(seen->second % HISTORY) * SCREEN_SIZE], screen, SCREEN_SIZE) == 0)
+    {
+        _buffer.push_back(REPEAT);
+        putLength(_buffer, frame - _lastFrame);
+        putLength(_buffer, _distinct - seen->second);
+        ++_repeats;
+    }
+    else
+    {
+        _encoded.clear();
+        encodeDelta(_current.data(), screen, SCREEN_SIZE, _encoded);
+        _buffer.push_back(DELTA);
+        putLength(_buffer, frame - _lastFrame);
+        putLength(_buffer, _encoded.size());
+        _buffer.insert(_buffer.end(), _encoded.begin(), _encoded.end());
+
+        // The screen this one pushes out of the history can't be repeated any more
+        const size_t slot = _distinct % HISTORY;
+        if (_distinct >= HISTORY)
+        {
+            const std::unordered_map<uint64_t, uint64_t>::iterator old = _seen.find(_historyHashes[slot]);
+            if (old != _seen.end() && old->second == _distinct - HISTORY)
+            {
+                _seen.erase(old);
+            }
+        }
+        memcpy(&_history[slot * SCREEN_SIZE], screen, SCREEN_SIZE);
+        _historyHashes[slot] = hash;
+        _seen[hash] = _distinct++;
+    }
+
+    memcpy(_current.data(), screen, SCREEN_SIZE);
+    _lastFrame = frame;
+    ++_screens;
+
+    if (_buffer.size() >= FLUSH_SIZE)
+    {
+        flush();
+    }
+}
+
+bool frameRecorder::close(const uint64_t frame)
+{
+    if (_file == nullptr)
+    {
+        return !_failed;
+    }
+
+    _buffer.push_back(END);
+    putLength(_buffer, frame > _lastFrame ? frame - _lastFrame : 0);
+    flush();
+
+    _failed |= fclose(_file) != 0;
+    _file = nullptr;
+    return !_failed;
+}
+
+void frameRecorder::flush()
+{
+    _failed |= fwrite(_buffer.data(), 1, _buffer.size(), _file) != _buffer.size();
+    _buffer.clear();
+}
+
+uint64_t frameRecorder::screens() const
+{
+    return _screens;
+}
+
+uint64_t frameRecorder::repeats() const
+{
+    return _repeats;
+}
+
+frameStream::frameStream()
+    : _position(0), _frame(0), _ended(true), _current(SCREEN_SIZE), _history(HISTORY * SCREEN_SIZE), _distinct(0)
+{
+}
+
+bool frameStream::open(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    _data.clear();
+    unsigned char block[4096];
+    size_t size;
+    while ((size = fread(block, 1, sizeof(block), file)) > 0)
+    {
+        _data.insert(_data.end(), block, block + size);
+    }
+    fclose(file);
+
+    if (_data.size() < sizeof(MAGIC) + 1 || memcmp(_data.data(), MAGIC, sizeof(MAGIC)) != 0 || _data[sizeof(MAGIC)] != VERSION)
+    {
+        fprintf(stderr, "%s is not a frame stream\n", path);
+        return false;
+    }
+
+    _position = sizeof(MAGIC) + 1;
+    _frame = 0;
+    _ended = false;
+    memset(_current.data(), 0, SCREEN_SIZE);
+    _distinct = 0;
+    return true;
+}
+
+bool frameStream::next(uint64_t &frame, uint64_t *gfx)
+{
+    const unsigned char *end = _data.data() + _data.size();
+
+    // A recording cut short, by a crash for instance, ends after its last whole record, and so does a corrupt one
+    while (!_ended && _position < _data.size())
+    {
+        const unsigned char *in = &_data[_position];
+        const unsigned char type = *in++;
+        size_t advance;
+        if (!getLength(in, end, advance))
+        {
+            break;
+        }
+        _frame += advance;
+
+        if (type == DELTA)
+        {
+            size_t size;
+            if (!getLength(in, end, size) || (size_t)(end - in) < size || !applyDelta(in, in + size, _current.data(), SCREEN_SIZE))
+            {
+                break;
+            }
+            in += size;
+            memcpy(&_history[(_distinct++ % HISTORY) * SCREEN_SIZE], _current.data(), SCREEN_SIZE);
+        }
+        else if (type == REPEAT)
+        {
+            size_t back;
+            if (!getLength(in, end, back) || back == 0 || back > HISTORY || back > _distinct)
+            {
+                break;
+            }
+            memcpy(_current.data(), &_history[((_distinct - back) % HISTORY) * SCREEN_SIZE], SCREEN_SIZE);
+        }
+        else
+        {
+            break;
+        }
+
+        _position = in - _data.data();
+        frame = _frame;
+        unpack(_current.data(), gfx);
+        return true;
+    }
+
+    _ended = true;
+    return false;
+}
+
+uint64_t frameStream::end() const
+{
+    return _frame;
+}
@@ -0,0 +1,90 @@
+/// Recording of a chip8 screen over time, and playing it back
+/// frameRecorder writes every change of the screen as it happens, stamped with the 60hz frame it
+/// appeared at, frameStream reads them back in order.
+///
+/// File layout, all numbers are little endian base 128 varints:
+///     "C8FS" and a version byte
+///     records, each one type byte followed by the frames since the previous record
+///         DELTA   size, then the XOR of the screen and the one before it, see delta.h
+///         REPEAT  how many distinct screens back in the history the screen is
+///         END     the recording stops, the last screen stays up until this frame
+///
+/// A screen is 32 rows of 8 bytes, the leftmost pixel in the high bit of the first byte.
+/// The history holds the last HISTORY screens written as deltas, so a program flipping between
+/// a few screens (menus, blinking text) costs a couple of bytes per flip once it has shown them.
+///
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+class frameRecorder
+{
+public:
+    frameRecorder();
+    ~frameRecorder();
+
+    bool open(const char *path);
+
+    /// Record a screen laid out like chip8::gfx(), unless it is the one already recorded
+    /// Meant to be called whenever the machine's draw flag is set, other calls cost a comparison.
+    void record(const uint64_t *gfx, const uint64_t frame);
+
+    /// End the recording at frame and close the file, returns false if anything could not be written
+    bool close(const uint64_t frame);
+
+    /// Screens recorded, and how many of those were found in the history
+    uint64_t screens() const;
+    uint64_t repeats() const;
+
+private:
+    void flush();
+
+    FILE *_file;
+    bool _failed;
+    std::vector<unsigned char> _buffer;
+
+    uint64_t _lastFrame;
+    std::vector<unsigned char> _current;
+    std::vector<unsigned char> _encoded;
+
+    /// Distinct screens in the history by hash, numbered in the order they were written,
+    /// and the screens themselves to rule out hash collisions, indexed by number modulo HISTORY
+    std::unordered_map<uint64_t, uint64_t> _seen;
+    std::vector<unsigned char> _history;
+    std::vector<uint64_t> _historyHashes;
+    uint64_t _distinct;
+
+    uint64_t _screens;
+    uint64_t _repeats;
+};
+
+class frameStream
+{
+public:
+    frameStream();
+
+    /// Read a whole recording into memory
+    bool open(const char *path);
+
+    /// The next screen and the frame it appeared at, returns false once the recording ends
+    bool next(uint64_t &frame, uint64_t *gfx);
+
+    /// Frame the recording ended at, known once next() has returned false
+    uint64_t end() const;
+
+private:
+    std::vector<unsigned char> _data;
+    size_t _position;
+
+    uint64_t _frame;
+    bool _ended;
+    std::vector<unsigned char> _current;
+    std::vector<unsigned char> _history;
+    uint64_t _distinct;
+};
+
+#endif
@@ -0,0 +1,346 @@
+/// Golden frame regression checker
+/// Runs scripted ROM scenarios headless on all cores, fingerprints the machine at checkpoint frames
+/// and compares the fingerprints with golden files recorded from a known good build.
+///
+/// Usage: golden <scenario file> [-g golden directory] [-u] [-j threads] [-d switch|cache|jit|threaded|aot] [-q vip|schip|modern]
+///
+/// A scenario file has one scenario per line: <name> <rom path> <frames> <checkpoint every> [input log]
+/// Scenarios with an input log replay it, using the seed recorded in the log.
+/// Blank lines and lines starting with # are ignored.
+///
+/// Every checkpoint records the screen, V register and memory hashes along with the screen itself,
+/// so a failure can show what was drawn. Goldens live in <golden directory>/<name>.golden, by
+/// default in a golden directory next to the scenario file. -u writes them instead of checking,
+/// after which they are plain text and show up in a diff like any other file.
+///
+/// Prints every failed scenario with its first differing checkpoint and exits with 1 if any failed.
+///
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <inttypes.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "inputlog.h"
+#include "random.h"
+#include "threadpool.h"
+
+const char *USAGE = "Usage: golden <scenario file> [-g golden directory] [-u] [-j threads] [-d switch|cache|jit|threaded|aot] [-q vip|schip|modern]\n";
+
+struct checkpoint
+{
+    uint64_t frame;
+    uint64_t gfxHash;
+    uint64_t vHash;
+    uint64_t memoryHash;
+    uint64_t gfx[32];
+};
+
+struct scenario
+{
+    std::string name;
+    std::string rom;
+    uint64_t frames;
+    uint64_t every;
+    std::string inputs;
+
+    bool loaded;
+    std::vector<checkpoint> actual;
+};
+
+bool readScenarios(const char *path, std::vector<scenario> &scenarios)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "Could not open scenario file %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line))
+    {
+        ++number;
+        std::istringstream fields(line);
+        scenario entry = scenario();
+        if (!(fields >> entry.name) || entry.name[0] == '#')
+        {
+            continue;
+        }
+        if (!(fields >> entry.rom >> entry.frames >> entry.every) || entry.every == 0)
+        {
+            fprintf(stderr, "%s:%d: expected <name> <rom path> <frames> <checkpoint every> [input log]\n", path, number);
+            return false;
+        }
+        fields >> entry.inputs;
+        scenarios.push_back(entry);
+    }
+    return true;
+}
+
+void run(scenario &entry, const chip8::dispatch mode, const quirks preset)
+{
+    std::unique_ptr<chip8> machine(new chip8());
+    machine->init();
+    machine->setDispatch(mode);
+    machine->setQuirks(preset);
+    machine->seed(DEFAULT_SEED);
+    entry.loaded = machine->load(entry.rom.c_str());
+
+    inputLog inputs;
+    if (!entry.inputs.empty())
+    {
+        entry.loaded = entry.loaded && inputs.load(entry.inputs.c_str());
+        inputs.rewind(*machine);
+    }
+
+    if (!entry.loaded)
+    {
+        return;
+    }
+
+    entry.actual.reserve(entry.frames / entry.every);
+    for (uint64_t frame = 1; frame <= entry.frames; ++frame)
+    {
+        inputs.replay(*machine);
+        machine->runFrame();
+
+        if (frame % entry.every == 0)
+        {
+            checkpoint point;
+            point.frame = frame;
+            point.gfxHash = machine->gfxHash();
+            point.vHash = machine->vHash();
+            point.memoryHash = machine->memoryHash();
+            memcpy(point.gfx, machine->gfx(), sizeof(point.gfx));
+            entry.actual.push_back(point);
+        }
+    }
+}
+
+/// Golden file layout, one checkpoint per line:
+/// frame, screen hash, V hash, memory hash, then the 32 screen rows as 16 hex digits each
+bool writeGolden(const std::string &path, const scenario &entry)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    fprintf(file, "# %s: %s for %" PRIu64 " frames, checkpoint every %" PRIu64 "\n", entry.name.c_str(), entry.rom.c_str(), entry.frames, entry.every);
+    for (size_t i = 0; i < entry.actual.size(); ++i)
+    {
+        const checkpoint &point = entry.actual[i];
+        fprintf(file, "%" PRIu64 " %016" PRIx64 " %016" PRIx64 " %016" PRIx64 " ", point.frame, point.gfxHash, point.vHash, point.memoryHash);
+        for (int y = 0; y < 32; ++y)
+        {
+            fprintf(file, "%016" PRIx64, point.gfx[y]);
+        }
+        fputc('\n', file);
+    }
+    return fclose(file) == 0;
+}
+
+bool readGolden(const std::string &path, std::vector<checkpoint> &golden)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        checkpoint point;
+        std::string rows;
+        if (!(fields >> point.frame >> std::hex >> point.gfxHash >> point.vHash >> point.memoryHash >> rows) || rows.size() != 32 * 16)
+        {
+            return false;
+        }
+        for (int y = 0; y < 32; ++y)
+        {
+            point.gfx[y] = strtoull(rows.substr(y * 16, 16).c_str(), nullptr, 16);
+        }
+        golden.push_back(point);
+    }
+    return true;
+}
+
+/// Draw both screens as one grid: # lit in both, - only lit in the golden, + only lit now
+void printScreenDiff(const uint64_t *expected, const uint64_t *actual)
+{
+    printf("    screen, # both  - golden only  + now only\n");
+    for (int y = 0; y < 32; ++y)
+    {
+        char line[65];
+        for (int x = 0; x < 64; ++x)
+        {
+            const bool was = (expected[y] >> (63 - x)) & 1;
+            const bool is = (actual[y] >> (63 - x)) & 1;
+            line[x] = was && is ? '#' : was ? '-' : is ? '+' : '.';
+        }
+        line[64] = 0;
+        printf("    %s%s\n", line, expected[y] != actual[y] ? "  <" : "");
+    }
+}
+
+/// Compare a scenario with its golden checkpoints, printing the first difference
+bool check(const scenario &entry, const std::vector<checkpoint> &golden)
+{
+    const size_t count = golden.size() < entry.actual.size() ? golden.size() : entry.actual.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const checkpoint &expected = golden[i];
+        const checkpoint &actual = entry.actual[i];
+        if (expected.frame == actual.frame && expected.gfxHash == actual.gfxHash &&
+            expected.vHash == actual.vHash && expected.memoryHash == actual.memoryHash)
+        {
+            continue;
+        }
+
+        printf("FAIL %s at frame %" PRIu64 ", checkpoint %zu of %zu:%s%s%s%s\n", entry.name.c_str(), actual.frame, i + 1, golden.size(),
+               expected.frame != actual.frame ? " checkpoint frames differ" : "",
+               expected.gfxHash != actual.gfxHash ? " screen" : "",
+               expected.vHash != actual.vHash ? " V registers" : "",
+               expected.memoryHash != actual.memoryHash ? " memory" : "");
+        if (expected.gfxHash != actual.gfxHash)
+        {
+            printScreenDiff(expected.gfx, actual.gfx);
+        }
+        return false;
+    }
+
+    if (golden.size() != entry.actual.size())
+    {
+        printf("FAIL %s: %zu checkpoints, the golden has %zu\n", entry.name.c_str(), entry.actual.size(), golden.size());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    std::filesystem::path goldenDirectory = std::filesystem::path(argv[1]).parent_path() / "golden";
+    bool update = false;
+    unsigned int threads = 0;
+    chip8::dispatch mode = chip8::dispatch::DECODE_CACHE;
+    quirks preset = quirks::MODERN;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-u") == 0)
+        {
+            update = true;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-g") == 0)
+        {
+            goldenDirectory = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-j") == 0)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-d") == 0)
+        {
+            if (!parseDispatch(argv[++i], mode))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-q") == 0)
+        {
+            if (!parseQuirks(argv[++i], preset))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+        }
+        else
+        {
+            fputs(USAGE, stderr);
+            return 1;
+        }
+    }
+
+    std::vector<scenario> scenarios;
+    if (!readScenarios(argv[1], scenarios))
+    {
+        return 1;
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        threadPool pool(threads);
+        for (size_t i = 0; i < scenarios.size(); ++i)
+        {
+            scenario *entry = &scenarios[i];
+            pool.submit([entry, mode, preset]
+                        { run(*entry, mode, preset); });
+        }
+        pool.wait();
+    }
+    const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (update)
+    {
+        std::filesystem::create_directories(goldenDirectory);
+    }
+
+    int failed = 0;
+    uint64_t checkpoints = 0;
+    for (size_t i = 0; i < scenarios.size(); ++i)
+    {
+        const scenario &entry = scenarios[i];
+        const std::string path = (goldenDirectory / (entry.name + ".golden")).string();
+        checkpoints += entry.actual.size();
+
+        if (!entry.loaded)
+        {
+            printf("FAIL %s: could not load %s\n", entry.name.c_str(), entry.rom.c_str());
+            ++failed;
+        }
+        else if (update)
+        {
+            failed += writeGolden(path, entry) ? 0 : 1;
+        }
+        else
+        {
+            std::vector<checkpoint> golden;
+            if (!readGolden(path, golden))
+            {
+                printf("FAIL %s: no readable golden at %s, run with -u to record one\n", entry.name.c_str(), path.c_str());
+                ++failed;
+            }
+            else if (!check(entry, golden))
+            {
+                ++failed;
+            }
+        }
+    }
+
+    fprintf(stderr, "%zu scenarios, %" PRIu64 " checkpoints %s in %.1fms, %d failed\n",
+            scenarios.size(), checkpoints, update ? "recorded" : "checked", milliseconds, failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+/// Hashing used to fingerprint machine state, screens and ROM images
+///
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ULL;
+const uint64_t FNV_PRIME = 0x100000001B3ULL;
+
+/// 64-bit FNV-1a over a block of bytes
+/// Pass the previous result as hash to keep hashing across several blocks
+inline uint64_t fnv1a(const void *data, const size_t size, uint64_t hash = FNV_OFFSET_BASIS)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,256 @@
+/// Instruction sequence miner
+/// Runs every ROM in a directory tree and counts how often each sequence of two and three
+/// instructions runs straight through, to choose the superinstructions chip8 fuses from data
+/// rather than guesswork, see chip8::fuse().
+///
+/// Usage: idioms <rom directory> [-f frames] [-n top] [-j threads] [-q vip|schip|modern]
+///
+/// Needs a profiling build (-DCHIP8_PROFILE), which is what does the counting.
+///
+/// Sequences are printed as opcode patterns with the registers named X, Y, Z... in the order they
+/// first appear, so 7XNN 3XNN 1NNN tests the register it just counted up and 7XNN 3YNN 1NNN does not.
+/// Each line gives how many times the sequence ran, its share of every instruction run, which is
+/// roughly the dispatches fusing it would save, and how many ROMs ran it at all.
+/// Identical ROMs are only run once.
+///
+#include <algorithm>
+#include <inttypes.h>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "romlibrary.h"
+#include "threadpool.h"
+
+#ifndef CHIP8_PROFILE
+#error "idioms counts instructions with the profiler, build it with -DCHIP8_PROFILE"
+#endif
+
+const uint64_t DEFAULT_FRAMES = 600;
+const unsigned int DEFAULT_TOP = 20;
+
+const char *USAGE = "Usage: idioms <rom directory> [-f frames] [-n top] [-j threads] [-q vip|schip|modern]\n";
+
+/// Longest sequence counted, the profiler tracks pairs and triples
+const int LONGEST = 3;
+
+struct count
+{
+    uint64_t runs;
+    uint64_t roms;
+};
+
+/// Every sequence seen by pattern, for lengths 2 and 3
+std::map<std::string, count> totals[LONGEST + 1];
+uint64_t totalInstructions = 0;
+std::mutex totalsMutex;
+
+/// Opcodes as a pattern like 6XNN 6YNN, naming registers by order of first appearance
+std::string pattern(const unsigned short *opcodes, const int length)
+{
+    const char NAMES[] = "XYZWUV";
+    int registers[6];
+    int named = 0;
+
+    // Letter for a register, the same one every time it comes up in the sequence
+    auto name = [&](const int reg)
+    {
+        for (int i = 0; i < named; ++i)
+        {
+            if (registers[i] == reg)
+            {
+                return NAMES[i];
+            }
+        }
+        registers[named] = reg;
+        return NAMES[named++];
+    };
+
+    std::string text;
+    char digits[8];
+    for (int i = 0; i < length; ++i)
+    {
+        const unsigned short opcode = opcodes[i];
+        const unsigned int high = opcode >> 12;
+        const int x = (opcode >> 8) & 0xF;
+        const int y = (opcode >> 4) & 0xF;
+        if (i > 0)
+        {
+            text += ' ';
+        }
+
+        switch (high)
+        {
+        case 0x0:
+            // Decoding only looks at the low nibble, which is how 0x0NN0 ends up as 00E0
+            snprintf(digits, sizeof(digits), "%s", (opcode & 0xF) == 0x0 ? "00E0" : (opcode & 0xF) == 0xE ? "00EE" : "0NNN");
+            break;
+        case 0x1:
+        case 0x2:
+        case 0xA:
+        case 0xB:
+            snprintf(digits, sizeof(digits), "%XNNN", high);
+            break;
+        case 0x5:
+        case 0x8:
+        case 0x9:
+        case 0xD:
+        {
+            // Named one after the other, the order arguments are evaluated in is up to the compiler
+            const char first = name(x);
+            const char second = name(y);
+            if (high == 0xD)
+            {
+                snprintf(digits, sizeof(digits), "D%c%cN", first, second);
+            }
+            else
+            {
+                snprintf(digits, sizeof(digits), "%X%c%c%X", high, first, second, opcode & 0xF);
+            }
+            break;
+        }
+        case 0xE:
+        case 0xF:
+            snprintf(digits, sizeof(digits), "%X%c%02X", high, name(x), opcode & 0xFF);
+            break;
+        default:
+            snprintf(digits, sizeof(digits), "%X%cNN", high, name(x));
+        }
+        text += digits;
+    }
+    return text;
+}
+
+void run(const std::string &path, const uint64_t frames, const quirks preset)
+{
+    std::unique_ptr<chip8> machine(new chip8());
+    machine->init();
+    machine->setQuirks(preset);
+    if (!machine->load(path.c_str()))
+    {
+        return;
+    }
+
+    for (uint64_t frame = 0; frame < frames; ++frame)
+    {
+        machine->runFrame();
+    }
+
+    // Gather this ROM's sequences before touching the totals, so the lock is held briefly
+    const profiler &profile = machine->profile();
+    std::map<std::string, uint64_t> found[LONGEST + 1];
+    for (unsigned int address = 0; address < 4096; ++address)
+    {
+        for (int length = 2; length <= LONGEST; ++length)
+        {
+            const uint64_t runs = profile.sequences(address, length);
+            if (runs == 0)
+            {
+                continue;
+            }
+
+            unsigned short opcodes[LONGEST];
+            for (int i = 0; i < length; ++i)
+            {
+                opcodes[i] = profile.opcode(address + i * 2);
+            }
+            found[length][pattern(opcodes, length)] += runs;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(totalsMutex);
+    totalInstructions += profile.instructions();
+    for (int length = 2; length <= LONGEST; ++length)
+    {
+        for (std::map<std::string, uint64_t>::const_iterator i = found[length].begin(); i != found[length].end(); ++i)
+        {
+            count &total = totals[length][i->first];
+            total.runs += i->second;
+            ++total.roms;
+        }
+    }
+}
+
+void report(const int length, const unsigned int top)
+{
+    std::vector<std::pair<std::string, count>> order(totals[length].begin(), totals[length].end());
+    std::stable_sort(order.begin(), order.end(), [](const std::pair<std::string, count> &a, const std::pair<std::string, count> &b)
+                     { return a.second.runs > b.second.runs; });
+
+    const double total = totalInstructions != 0 ? (double)totalInstructions : 1.0;
+    printf("\n%s\n", length == 2 ? "Pairs" : "Triples");
+    for (size_t i = 0; i < order.size() && i < top; ++i)
+    {
+        printf("  %-16s %14" PRIu64 " %6.2f%% %6" PRIu64 " roms\n", order[i].first.c_str(), order[i].second.runs,
+               order[i].second.runs * 100.0 / total, order[i].second.roms);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    uint64_t frames = DEFAULT_FRAMES;
+    unsigned int top = DEFAULT_TOP;
+    unsigned int threads = 0;
+    quirks preset = quirks::MODERN;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+        {
+            frames = strtoull(argv[i + 1], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            top = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            threads = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            if (!parseQuirks(argv[i + 1], preset))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+        }
+    }
+
+    romLibrary library;
+    library.scan(argv[1], threads);
+
+    size_t distinct = 0;
+    {
+        threadPool pool(threads);
+        const std::vector<romLibrary::rom> &roms = library.roms();
+        for (size_t i = 0; i < roms.size(); ++i)
+        {
+            // The library is in hash order, so copies of a ROM sit next to each other
+            if (i > 0 && roms[i].hash == roms[i - 1].hash)
+            {
+                continue;
+            }
+            ++distinct;
+
+            const std::string path = roms[i].path;
+            pool.submit([path, frames, preset]
+                        { run(path, frames, preset); });
+        }
+        pool.wait();
+    }
+
+    printf("%zu ROMs, %" PRIu64 " frames each, %" PRIu64 " instructions\n", distinct, frames, totalInstructions);
+    report(2, top);
+    report(3, top);
+    return 0;
+}
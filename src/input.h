@@ -0,0 +1,29 @@
+/// Key events on their way from the host's input callbacks to a chip8
+/// The host pushes events onto a keyQueue from its input thread, the emulation thread drains it
+/// into the machine's keypad, see chip8::setInputQueue().
+///
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <chrono>
+#include <stdint.h>
+#include "spscring.h"
+
+struct keyEvent
+{
+    /// When the host saw the event, see inputTime()
+    uint64_t time;
+    unsigned char key;
+    bool pressed;
+};
+
+/// Far more events than anyone can type between two frames
+typedef spscRing<keyEvent, 256> keyQueue;
+
+/// Steady clock time in nanoseconds, for stamping key events and measuring how long they take to show
+inline uint64_t inputTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
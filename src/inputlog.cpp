@@ -0,0 +1,197 @@
+#include "inputlog.h"
+#include "random.h"
+#include <stdio.h>
+#include <string.h>
+
+const char INPUT_LOG_MAGIC[4] = {'C', '8', 'I', 'L'};
+const unsigned char INPUT_LOG_VERSION = 2;
+
+static void writeVarint(FILE *file, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        fputc((value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc(value, file);
+}
+
+/// Read a varint whose first byte has already been read
+/// false if the file ends part way or the varint runs on past 64 bits
+static bool readVarint(FILE *file, int byte, uint64_t &value)
+{
+    value = 0;
+    int shift = 0;
+    while (byte != EOF && (byte & 0x80) && shift < 64)
+    {
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+        byte = fgetc(file);
+    }
+    if (byte == EOF || shift >= 64)
+    {
+        return false;
+    }
+    value |= (uint64_t)byte << shift;
+    return true;
+}
+
+inputLog::inputLog()
+    : _seed(DEFAULT_SEED), _position(0)
+{
+}
+
+void inputLog::begin(chip8 &machine, const uint64_t seed)
+{
+    _seed = seed;
+    _events.clear();
+    _position = 0;
+    machine.seed(seed);
+}
+
+void inputLog::apply(chip8 &machine, const unsigned char key, const bool pressed)
+{
+    event change;
+    change.frame = machine.frames();
+    change.instruction = machine.instructions();
+    change.key = key & 0xF;
+    change.pressed = pressed;
+    _events.push_back(change);
+
+    machine.setKey(change.key, pressed);
+}
+
+void inputLog::rewind(chip8 &machine)
+{
+    _position = 0;
+    machine.seed(_seed);
+}
+
+void inputLog::replay(chip8 &machine)
+{
+    const uint64_t frame = machine.frames();
+    const uint64_t now = machine.instructions();
+    while (_position < _events.size() &&
+           (_events[_position].frame < frame || (_events[_position].frame == frame && _events[_position].instruction <= now)))
+    {
+        machine.setKey(_events[_position].key, _events[_position].pressed);
+        ++_position;
+    }
+}
+
+bool inputLog::finished() const
+{
+    return _position == _events.size();
+}
+
+bool inputLog::save(const char *path) const
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    fwrite(INPUT_LOG_MAGIC, 1, sizeof(INPUT_LOG_MAGIC), file);
+    fputc(INPUT_LOG_VERSION, file);
+    for (int i = 0; i < 8; ++i)
+    {
+        fputc((_seed >> (i * 8)) & 0xFF, file);
+    }
+
+    uint64_t previousFrame = 0;
+    uint64_t previous = 0;
+    for (size_t i = 0; i < _events.size(); ++i)
+    {
+        writeVarint(file, _events[i].frame - previousFrame);
+        writeVarint(file, _events[i].instruction - previous);
+        previousFrame = _events[i].frame;
+        previous = _events[i].instruction;
+        fputc(_events[i].key | (_events[i].pressed << 4), file);
+    }
+
+    const bool written = ferror(file) == 0;
+    fclose(file);
+    return written;
+}
+
+bool inputLog::load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    char magic[sizeof(INPUT_LOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) != 0 || fgetc(file) != INPUT_LOG_VERSION)
+    {
+        fprintf(stderr, "%s is not an input log\n", path);
+        fclose(file);
+        return false;
+    }
+
+    uint64_t seed = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        const int byte = fgetc(file);
+        if (byte == EOF)
+        {
+            fprintf(stderr, "%s is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+        seed |= (uint64_t)byte << (i * 8);
+    }
+
+    _seed = seed;
+
+    _events.clear();
+    _position = 0;
+
+    uint64_t frame = 0;
+    uint64_t instruction = 0;
+    for (;;)
+    {
+        const int byte = fgetc(file);
+        if (byte == EOF)
+        {
+            break;
+        }
+
+        uint64_t frames;
+        uint64_t instructions;
+        const bool complete = readVarint(file, byte, frames) && readVarint(file, fgetc(file), instructions);
+        const int change = complete ? fgetc(file) : EOF;
+        if (change == EOF)
+        {
+            fprintf(stderr, "%s is truncated or corrupt\n", path);
+            fclose(file);
+            return false;
+        }
+        frame += frames;
+        instruction += instructions;
+
+        event entry;
+        entry.frame = frame;
+        entry.instruction = instruction;
+        entry.key = change & 0xF;
+        entry.pressed = (change >> 4) & 1;
+        _events.push_back(entry);
+    }
+
+    fclose(file);
+    return true;
+}
+
+uint64_t inputLog::seed() const
+{
+    return _seed;
+}
+
+const std::vector<inputLog::event> &inputLog::events() const
+{
+    return _events;
+}
@@ -0,0 +1,63 @@
+/// Record and replay of key input
+/// Key presses and releases are stamped with the number of frames the machine had run and the
+/// number of instructions it had executed when they were applied. Together with the seed of the
+/// machine that is all it takes to replay a run bit for bit.
+///
+/// Instructions alone are not enough: while FX0A waits for a key no instructions run but frames,
+/// and with them the timers, go on, so a key pressed a second into the wait has to be replayed a
+/// second into it too.
+///
+/// Log file format, all numbers little endian:
+/// "C8IL", version byte, 8 byte seed, then one entry per event:
+/// frames and instructions since the previous event as base 128 varints, then key | (pressed << 4)
+///
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <stdint.h>
+#include <vector>
+#include "chip8.h"
+
+class inputLog
+{
+public:
+    struct event
+    {
+        uint64_t frame;
+        uint64_t instruction;
+        unsigned char key;
+        bool pressed;
+    };
+
+    inputLog();
+
+    /// Start a recording, seeding the machine so the recording can be replayed
+    void begin(chip8 &machine, const uint64_t seed);
+
+    /// Apply a key change to the machine and record it
+    void apply(chip8 &machine, const unsigned char key, const bool pressed);
+
+    /// Seed the machine from the log and replay from the first event
+    void rewind(chip8 &machine);
+
+    /// Apply every recorded event the machine has caught up with, call before each runFrame() or cycle()
+    void replay(chip8 &machine);
+
+    /// True once every recorded event has been replayed
+    bool finished() const;
+
+    bool save(const char *path) const;
+    bool load(const char *path);
+
+    uint64_t seed() const;
+    const std::vector<event> &events() const;
+
+private:
+    uint64_t _seed;
+    std::vector<event> _events;
+
+    /// Next event to replay
+    size_t _position;
+};
+
+#endif
@@ -0,0 +1,529 @@
+#include "jit.h"
+#include "chip8.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X86_64
+#endif
+
+#ifdef JIT_X86_64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+/// Size of the executable code cache, the cache is flushed when it fills up
+const size_t CODE_CACHE_SIZE = 1024 * 1024;
+
+/// Longest run of Chip 8 instructions translated into a single block
+const int MAX_BLOCK_INSTRUCTIONS = 64;
+
+/// Worst case number of bytes a single translated instruction (plus the block epilogue) can take
+const size_t MAX_INSTRUCTION_BYTES = 64;
+
+/// Worst case size of a block
+const size_t MAX_BLOCK_BYTES = MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_BYTES + MAX_INSTRUCTION_BYTES;
+
+/// Granularity of page protection on x86-64
+const size_t PAGE_BYTES = 4096;
+
+#ifdef JIT_X86_64
+namespace
+{
+    /// Writes x86-64 machine code into the code cache
+    /// Every memory operand is addressed relative to rbx, which holds the machine pointer for the whole block
+    class emitter
+    {
+    public:
+        emitter(unsigned char *out)
+            : _out(out), _size(0)
+        {
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        void byte(const unsigned char value)
+        {
+            _out[_size++] = value;
+        }
+
+        void word(const unsigned short value)
+        {
+            byte(value & 0xFF);
+            byte(value >> 8);
+        }
+
+        void dword(const unsigned int value)
+        {
+            word(value & 0xFFFF);
+            word(value >> 16);
+        }
+
+        /// Emit an opcode whose ModRM operand is [rbx + disp32]
+        /// reg is either a register number or the /digit opcode extension
+        void rbx(const unsigned char opcode, const unsigned char reg, const int disp)
+        {
+            byte(opcode);
+            byte(0x80 | (reg << 3) | 3);
+            dword(disp);
+        }
+
+        /// Emit a two byte (0x0F prefixed) opcode whose ModRM operand is [rbx + disp32]
+        void rbx0F(const unsigned char opcode, const unsigned char reg, const int disp)
+        {
+            byte(0x0F);
+            rbx(opcode, reg, disp);
+        }
+
+    private:
+        unsigned char *_out;
+        size_t _size;
+    };
+
+    // Register numbers used in ModRM reg fields
+    const unsigned char AL = 0;
+    const unsigned char CL = 1;
+}
+#endif
+
+jit::jit()
+    : _code(nullptr), _codeSize(0), _codeUsed(0)
+{
+#ifdef JIT_X86_64
+#ifdef _WIN32
+    void *code = VirtualAlloc(nullptr, CODE_CACHE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READ);
+    if (code != nullptr)
+#else
+    void *code = mmap(nullptr, CODE_CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED)
+#endif
+    {
+        _code = (unsigned char *)code;
+        _codeSize = CODE_CACHE_SIZE;
+    }
+#endif
+    flush();
+}
+
+jit::~jit()
+{
+#ifdef JIT_X86_64
+    if (_code != nullptr)
+    {
+#ifdef _WIN32
+        VirtualFree(_code, 0, MEM_RELEASE);
+#else
+        munmap(_code, _codeSize);
+#endif
+    }
+#endif
+}
+
+int jit::run(chip8 &machine, const uint64_t budget)
+{
+    const unsigned short address = machine._programCounter;
+    if (address >= 4096 - 1)
+    {
+        return 0;
+    }
+
+    block entry = _blocks[address];
+    if (entry == nullptr)
+    {
+        if (_untranslatable[address])
+        {
+            return 0;
+        }
+
+        entry = translate(machine, address);
+        if (entry == nullptr)
+        {
+            return 0;
+        }
+    }
+
+    // Blocks never run past the budget, so frames end on the same instruction as when interpreting
+    if (_lengths[address] > budget)
+    {
+        return 0;
+    }
+    return entry(&machine);
+}
+
+void jit::invalidate(const unsigned short address)
+{
+    if (_covered[address & 0x0FFF])
+    {
+        flush();
+    }
+}
+
+void jit::flush()
+{
+    _codeUsed = 0;
+    memset(_blocks, 0, sizeof(_blocks));
+    memset(_lengths, 0, sizeof(_lengths));
+    memset(_untranslatable, 0, sizeof(_untranslatable));
+    memset(_covered, 0, sizeof(_covered));
+}
+
+jit::block jit::translate(chip8 &machine, const unsigned short address)
+{
+#ifdef JIT_X86_64
+    if (_code == nullptr)
+    {
+        _untranslatable[address] = true;
+        return nullptr;
+    }
+
+    // Start over with an empty cache if the block might not fit
+    if (_codeUsed + MAX_BLOCK_BYTES > _codeSize)
+    {
+        flush();
+    }
+
+    // The cache is never writable and executable at once, only the pages this block may take are opened for writing
+    if (!protect(_codeUsed, MAX_BLOCK_BYTES, true))
+    {
+        _untranslatable[address] = true;
+        return nullptr;
+    }
+
+    // Offsets of the registers we touch, relative to the machine pointer held in rbx
+    const char *base = (const char *)&machine;
+    const int v = (const char *)machine._v - base;
+    const int vf = v + 0xF;
+    const int indexRegister = (const char *)&machine._indexRegister - base;
+    const int programCounter = (const char *)&machine._programCounter - base;
+    const int stack = (const char *)machine._stack - base;
+    const int stackPointer = (const char *)&machine._stackPointer - base;
+
+    // Shifts are the only translated opcodes that depend on the quirks, setQuirks() flushes the cache
+    const bool shiftReadsVy = withQuirks(machine._quirks, [](auto policy)
+                                         { return decltype(policy)::SHIFT_READS_VY; });
+
+    unsigned char *start = _code + _codeUsed;
+    emitter out(start);
+
+    // push rbx, then keep the machine pointer in rbx for the rest of the block
+    out.byte(0x53);
+    out.byte(0x48);
+    out.byte(0x89);
+#ifdef _WIN32
+    out.byte(0xCB); // mov rbx, rcx
+#else
+    out.byte(0xFB); // mov rbx, rdi
+#endif
+
+    unsigned short pc = address;
+    int count = 0;
+
+    // Set when the last translated instruction already stored the new program counter
+    bool pcStored = false;
+
+    while (count < MAX_BLOCK_INSTRUCTIONS && pc < 4096 - 1)
+    {
+        const unsigned short opcode = machine._memory[pc] << 8 | machine._memory[pc + 1];
+        const int x = v + ((opcode & 0x0F00) >> 8);
+        const int y = v + ((opcode & 0x00F0) >> 4);
+        const int shifted = shiftReadsVy ? y : x;
+        const unsigned char nn = opcode & 0x00FF;
+        const unsigned short nnn = opcode & 0x0FFF;
+
+        bool translated = true;
+        bool endsBlock = false;
+
+        switch (opcode & 0xF000)
+        {
+        case 0x1000:
+            // mov word [pc], NNN
+            out.byte(0x66);
+            out.rbx(0xC7, 0, programCounter);
+            out.word(nnn);
+            endsBlock = true;
+            break;
+
+        case 0x2000:
+            // movzx eax, word [sp]; and eax, 0xF
+            out.rbx0F(0xB7, AL, stackPointer);
+            out.byte(0x83);
+            out.byte(0xE0);
+            out.byte(0x0F);
+            // mov word [stack + rax * 2], pc
+            out.byte(0x66);
+            out.byte(0xC7);
+            out.byte(0x84);
+            out.byte(0x43);
+            out.dword(stack);
+            out.word(pc);
+            // inc word [sp]
+            out.byte(0x66);
+            out.rbx(0xFF, 0, stackPointer);
+            // mov word [pc], NNN
+            out.byte(0x66);
+            out.rbx(0xC7, 0, programCounter);
+            out.word(nnn);
+            endsBlock = true;
+            break;
+
+        case 0x3000:
+        case 0x4000:
+            // cmp byte [VX], NN
+            out.rbx(0x80, 7, x);
+            out.byte(nn);
+            endsBlock = true;
+            break;
+
+        case 0x5000:
+        case 0x9000:
+            if ((opcode & 0x000F) != 0)
+            {
+                translated = false;
+                break;
+            }
+            // mov al, [VX]; cmp al, [VY]
+            out.rbx(0x8A, AL, x);
+            out.rbx(0x3A, AL, y);
+            endsBlock = true;
+            break;
+
+        case 0x6000:
+            // mov byte [VX], NN
+            out.rbx(0xC6, 0, x);
+            out.byte(nn);
+            break;
+
+        case 0x7000:
+            // add byte [VX], NN
+            out.rbx(0x80, 0, x);
+            out.byte(nn);
+            break;
+
+        case 0x8000:
+            switch (opcode & 0x000F)
+            {
+            case 0x0000:
+                // mov al, [VY]; mov [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x88, AL, x);
+                break;
+            case 0x0001:
+                // mov al, [VY]; or [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x08, AL, x);
+                break;
+            case 0x0002:
+                // mov al, [VY]; and [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x20, AL, x);
+                break;
+            case 0x0003:
+                // mov al, [VY]; xor [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x30, AL, x);
+                break;
+            case 0x0004:
+                // VF = VY > VX, written before the add just like the interpreter
+                // mov al, [VY]; cmp al, [VX]; seta al; mov [VF], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x3A, AL, x);
+                out.byte(0x0F);
+                out.byte(0x97);
+                out.byte(0xC0);
+                out.rbx(0x88, AL, vf);
+                // mov al, [VY]; add [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x00, AL, x);
+                break;
+            case 0x0005:
+                // VF = VY <= VX
+                // mov al, [VY]; cmp al, [VX]; setbe al; mov [VF], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x3A, AL, x);
+                out.byte(0x0F);
+                out.byte(0x96);
+                out.byte(0xC0);
+                out.rbx(0x88, AL, vf);
+                // mov al, [VY]; sub [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x28, AL, x);
+                break;
+            case 0x0006:
+                // Reads the source once and stores VF last, just like the interpreter
+                // mov al, [source]; mov cl, al; shr al, 1; mov [VX], al; and cl, 1; mov [VF], cl
+                out.rbx(0x8A, AL, shifted);
+                out.byte(0x88);
+                out.byte(0xC1);
+                out.byte(0xD0);
+                out.byte(0xE8);
+                out.rbx(0x88, AL, x);
+                out.byte(0x80);
+                out.byte(0xE1);
+                out.byte(0x01);
+                out.rbx(0x88, CL, vf);
+                break;
+            case 0x0007:
+                // VF = VX <= VY
+                // mov al, [VX]; cmp al, [VY]; setbe al; mov [VF], al
+                out.rbx(0x8A, AL, x);
+                out.rbx(0x3A, AL, y);
+                out.byte(0x0F);
+                out.byte(0x96);
+                out.byte(0xC0);
+                out.rbx(0x88, AL, vf);
+                // mov al, [VY]; sub al, [VX]; mov [VX], al
+                out.rbx(0x8A, AL, y);
+                out.rbx(0x2A, AL, x);
+                out.rbx(0x88, AL, x);
+                break;
+            case 0x000E:
+                // mov al, [source]; mov cl, al; shl al, 1; mov [VX], al; shr cl, 7; mov [VF], cl
+                out.rbx(0x8A, AL, shifted);
+                out.byte(0x88);
+                out.byte(0xC1);
+                out.byte(0xD0);
+                out.byte(0xE0);
+                out.rbx(0x88, AL, x);
+                out.byte(0xC0);
+                out.byte(0xE9);
+                out.byte(0x07);
+                out.rbx(0x88, CL, vf);
+                break;
+            default:
+                translated = false;
+            }
+            break;
+
+        case 0xA000:
+            // mov word [I], NNN
+            out.byte(0x66);
+            out.rbx(0xC7, 0, indexRegister);
+            out.word(nnn);
+            break;
+
+        case 0xF000:
+            if ((opcode & 0x00FF) != 0x001E)
+            {
+                // Timer, key, font and memory opcodes stay in the interpreter
+                translated = false;
+                break;
+            }
+            // VF = I + VX > 0xFFF, written before I is updated just like the interpreter
+            // movzx ecx, byte [VX]; movzx eax, word [I]; add eax, ecx; cmp eax, 0xFFF; seta al; mov [VF], al
+            out.rbx0F(0xB6, CL, x);
+            out.rbx0F(0xB7, AL, indexRegister);
+            out.byte(0x01);
+            out.byte(0xC8);
+            out.byte(0x3D);
+            out.dword(0xFFF);
+            out.byte(0x0F);
+            out.byte(0x97);
+            out.byte(0xC0);
+            out.rbx(0x88, AL, vf);
+            // movzx ecx, byte [VX]; add word [I], cx
+            out.rbx0F(0xB6, CL, x);
+            out.byte(0x66);
+            out.rbx(0x01, CL, indexRegister);
+            break;
+
+        default:
+            translated = false;
+        }
+
+        if (!translated)
+        {
+            break;
+        }
+
+        _covered[pc] = true;
+        _covered[pc + 1] = true;
+        ++count;
+
+        if (endsBlock)
+        {
+            const unsigned short op = opcode & 0xF000;
+            if (op != 0x1000 && op != 0x2000)
+            {
+                // A skip: the flags from the comparison above pick the next program counter
+                // mov eax, pc + 2; mov ecx, pc + 4; cmove/cmovne eax, ecx; mov [pc], ax
+                out.byte(0xB8);
+                out.dword(pc + 2);
+                out.byte(0xB9);
+                out.dword(pc + 4);
+                out.byte(0x0F);
+                out.byte(op == 0x3000 || op == 0x5000 ? 0x44 : 0x45);
+                out.byte(0xC1);
+                out.byte(0x66);
+                out.rbx(0x89, AL, programCounter);
+            }
+            pcStored = true;
+            break;
+        }
+
+        pc += 2;
+    }
+
+    if (count == 0)
+    {
+        // Nothing was emitted beyond the prologue, leave this instruction to the interpreter
+        protect(_codeUsed, MAX_BLOCK_BYTES, false);
+        _untranslatable[address] = true;
+        return nullptr;
+    }
+
+    if (!pcStored)
+    {
+        // Fell off the end of a straight-line run, continue at the first instruction we did not translate
+        // mov word [pc], pc
+        out.byte(0x66);
+        out.rbx(0xC7, 0, programCounter);
+        out.word(pc);
+    }
+
+    // mov eax, count; pop rbx; ret
+    out.byte(0xB8);
+    out.dword(count);
+    out.byte(0x5B);
+    out.byte(0xC3);
+
+    if (!protect(_codeUsed, MAX_BLOCK_BYTES, false))
+    {
+        _untranslatable[address] = true;
+        return nullptr;
+    }
+
+    _codeUsed += out.size();
+    _blocks[address] = (block)start;
+    _lengths[address] = count;
+    return _blocks[address];
+#else
+    _untranslatable[address] = true;
+    return nullptr;
+#endif
+}
+
+/// Make the pages holding size bytes of the cache from offset on writable, or executable again
+/// Returns false if the protection could not be changed.
+bool jit::protect(const size_t offset, const size_t size, const bool writable)
+{
+#ifdef JIT_X86_64
+    const size_t first = offset / PAGE_BYTES * PAGE_BYTES;
+    const size_t end = offset + size < _codeSize ? offset + size : _codeSize;
+#ifdef _WIN32
+    DWORD previous;
+    return VirtualProtect(_code + first, end - first, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &previous) != 0;
+#else
+    return mprotect(_code + first, end - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+#else
+    (void)offset;
+    (void)size;
+    (void)writable;
+    return false;
+#endif
+}
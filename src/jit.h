@@ -0,0 +1,68 @@
+/// Dynamic recompiler for Chip 8 basic blocks
+/// Translates straight-line runs of Chip 8 code into native x86-64 and keeps them in an
+/// executable code cache keyed by program counter. The cache is never writable and executable at
+/// the same time, the pages a block goes into are only made writable while it is emitted.
+///
+/// A block ends at the first jump, call or skip (which is translated as the last instruction),
+/// or just before the first instruction the translator does not handle. Those instructions
+/// are left to the interpreter, which remains the reference implementation.
+///
+/// On hosts other than x86-64 nothing is ever translated and the interpreter runs everything.
+///
+/// Translated code keeps no Chip 8 state in host registers. Every instruction loads its operands
+/// from the machine and stores its result straight back, so a block can stop after any instruction
+/// and the interpreter always sees up to date registers. The gain over the interpreter comes from
+/// doing away with fetch, decode and dispatch, not from register allocation.
+///
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class chip8;
+
+class jit
+{
+public:
+    jit();
+    ~jit();
+
+    /// Run the translated block starting at the program counter of the machine, translating it first if needed,
+    /// unless it is longer than budget instructions
+    /// Returns the number of Chip 8 instructions executed, or 0 if the instruction at the program counter must be interpreted
+    int run(chip8 &machine, const uint64_t budget);
+
+    /// Called for every byte a program writes to memory
+    /// If the byte belongs to translated code the whole cache is flushed
+    void invalidate(const unsigned short address);
+
+    /// Throw away all translated code
+    void flush();
+
+private:
+    /// Translated blocks take the machine and return how many instructions they executed
+    typedef int (*block)(chip8 *machine);
+
+    block translate(chip8 &machine, const unsigned short address);
+    bool protect(const size_t offset, const size_t size, const bool writable);
+
+    /// Memory that translated blocks are emitted into, executable but only writable while a block is emitted
+    unsigned char *_code;
+    size_t _codeSize;
+    size_t _codeUsed;
+
+    /// Entry point of the translated block for every address, or nullptr if there is none yet
+    block _blocks[4096];
+
+    /// Instructions the block at every address runs
+    unsigned char _lengths[4096];
+
+    /// Set for addresses whose first instruction cannot be translated, so we do not keep retrying
+    bool _untranslatable[4096];
+
+    /// Set for every byte of Chip 8 memory that some translated block was generated from
+    bool _covered[4096];
+};
+
+#endif
@@ -0,0 +1,613 @@
+#include "lockstep.h"
+#include "hash.h"
+#include "random.h"
+#include <stdio.h>
+#include <string.h>
+#include "lockstepvector.h"
+
+extern unsigned char chip8_fontset[80];
+
+const unsigned short PROGRAM_START_ADDRESS = 512;
+
+/// Lanes are allocated in multiples of the widest vector any build runs them as
+const unsigned int VECTOR_LANES = 32;
+
+namespace
+{
+    inline uint64_t rotateRight(const uint64_t row, const unsigned int shift)
+    {
+        return (row >> shift) | (row << ((64 - shift) & 63));
+    }
+}
+
+/// Without AVX2 every "vector" is a single lane, the same kernels then run as plain loops
+struct scalarVector
+{
+    static const unsigned int BYTE_LANES = 1;
+    static const unsigned int WORD_LANES = 1;
+
+    typedef unsigned int vec;
+
+    static vec loadBytes(const unsigned char *lanes)
+    {
+        return *lanes;
+    }
+
+    static void storeBytes(unsigned char *lanes, const vec value)
+    {
+        *lanes = value;
+    }
+
+    static vec loadWords(const unsigned short *lanes)
+    {
+        return *lanes;
+    }
+
+    static void storeWords(unsigned short *lanes, const vec value)
+    {
+        *lanes = value;
+    }
+
+    static vec loadMaskWords(const unsigned char *mask)
+    {
+        return *mask ? 0xFFFF : 0;
+    }
+
+    static vec bytes(const unsigned char value)
+    {
+        return value;
+    }
+
+    static vec words(const unsigned short value)
+    {
+        return value;
+    }
+
+    static vec select(const vec mask, const vec a, const vec b)
+    {
+        return (a & mask) | (b & ~mask);
+    }
+
+    static vec andBits(const vec a, const vec b)
+    {
+        return a & b;
+    }
+
+    static vec orBits(const vec a, const vec b)
+    {
+        return a | b;
+    }
+
+    static vec xorBits(const vec a, const vec b)
+    {
+        return a ^ b;
+    }
+
+    static vec addBytes(const vec a, const vec b)
+    {
+        return (a + b) & 0xFF;
+    }
+
+    static vec subBytes(const vec a, const vec b)
+    {
+        return (a - b) & 0xFF;
+    }
+
+    static vec addWords(const vec a, const vec b)
+    {
+        return (a + b) & 0xFFFF;
+    }
+
+    static vec equalBytes(const vec a, const vec b)
+    {
+        return a == b ? 0xFF : 0;
+    }
+
+    static vec aboveBytes(const vec a, const vec b)
+    {
+        return a > b ? 0xFF : 0;
+    }
+
+    static vec shiftRightBytes(const vec a)
+    {
+        return a >> 1;
+    }
+
+    static vec topBitBytes(const vec a)
+    {
+        return a >> 7;
+    }
+
+    static vec decrementBytes(const vec a)
+    {
+        return a > 0 ? a - 1 : 0;
+    }
+
+    static unsigned int markLanes(unsigned short *programCounter, unsigned char *mask, const unsigned short address)
+    {
+        *programCounter &= 0x0FFF;
+        *mask = *programCounter == address ? 0xFF : 0x00;
+        return *mask & 1;
+    }
+};
+
+LOCKSTEP_INSTANTIATE(scalarVector)
+
+lockstep::lockstep(const unsigned int lanes, const bool allowAvx2)
+{
+    // Whole vectors only, so the kernels never need a tail loop
+    _lanes = (lanes + VECTOR_LANES - 1) / VECTOR_LANES * VECTOR_LANES;
+    if (_lanes == 0)
+    {
+        _lanes = VECTOR_LANES;
+    }
+
+    _markLeaders = &lockstep::markLeaders<scalarVector>;
+    _executeVector = &lockstep::executeVector<scalarVector>;
+    _countDownTimers = &lockstep::countDownTimers<scalarVector>;
+    _avx2 = false;
+#ifdef CHIP8_LOCKSTEP_AVX2
+    if (allowAvx2 && __builtin_cpu_supports("avx2"))
+    {
+        useAvx2();
+    }
+#else
+    (void)allowAvx2;
+#endif
+
+    _v.resize(16 * _lanes);
+    _indexRegister.resize(_lanes);
+    _programCounter.resize(_lanes);
+    _stack.resize(16 * _lanes);
+    _stackPointer.resize(_lanes);
+    _delayTimer.resize(_lanes);
+    _soundTimer.resize(_lanes);
+    _random.resize(_lanes);
+    _keys.resize(_lanes);
+    _waitingForKey.resize(_lanes);
+    _gfx.resize(32 * _lanes);
+    _memory.resize(4096 * _lanes);
+    _mask.resize(_lanes);
+    _condition.resize(_lanes);
+
+    init();
+}
+
+/// Reset every lane to the state chip8::init() leaves a machine in
+void lockstep::init()
+{
+    memset(_image, 0, sizeof(_image));
+    memcpy(_image, chip8_fontset, sizeof(chip8_fontset));
+    memset(_written, 0, sizeof(_written));
+
+    for (unsigned int lane = 0; lane < _lanes; ++lane)
+    {
+        memcpy(&_memory[lane * 4096], _image, sizeof(_image));
+        _programCounter[lane] = PROGRAM_START_ADDRESS;
+        _random[lane] = pcg32Seed(DEFAULT_SEED);
+    }
+
+    memset(_v.data(), 0, _v.size());
+    memset(_indexRegister.data(), 0, _indexRegister.size() * sizeof(unsigned short));
+    memset(_stack.data(), 0, _stack.size() * sizeof(unsigned short));
+    memset(_stackPointer.data(), 0, _stackPointer.size() * sizeof(unsigned short));
+    memset(_delayTimer.data(), 0, _delayTimer.size());
+    memset(_soundTimer.data(), 0, _soundTimer.size());
+    memset(_keys.data(), 0, _keys.size() * sizeof(unsigned short));
+    memset(_waitingForKey.data(), 0, _waitingForKey.size());
+    memset(_gfx.data(), 0, _gfx.size() * sizeof(uint64_t));
+
+    _instructions = 0;
+}
+
+/// Load the same program into every lane
+bool lockstep::load(const char *path)
+{
+    FILE *program = fopen(path, "rb");
+    if (program == nullptr)
+    {
+        fprintf(stderr, "Could not open program %s\n", path);
+        return false;
+    }
+
+    const size_t programSize = fread(_image + PROGRAM_START_ADDRESS, 1, sizeof(_image) - PROGRAM_START_ADDRESS, program);
+    const bool tooBig = fgetc(program) != EOF;
+    fclose(program);
+
+    if (tooBig)
+    {
+        fprintf(stderr, "Program %s is too big\n", path);
+        return false;
+    }
+
+    for (unsigned int lane = 0; lane < _lanes; ++lane)
+    {
+        memcpy(&_memory[lane * 4096 + PROGRAM_START_ADDRESS], _image + PROGRAM_START_ADDRESS, programSize);
+    }
+
+    return true;
+}
+
+void lockstep::step()
+{
+    // Lanes at the same place as lane 0 run its instruction together, unless most lanes are somewhere else
+    unsigned short address = _programCounter[0] & 0x0FFF;
+    unsigned int leaders = (this->*_markLeaders)(address);
+    if (leaders <= _lanes / 2)
+    {
+        const unsigned short common = commonAddress();
+        if (common != address)
+        {
+            address = common;
+            leaders = (this->*_markLeaders)(address);
+        }
+    }
+    const bool uniform = leaders == _lanes;
+
+    if (!_written[address] && !_written[(address + 1) & 0x0FFF])
+    {
+        (this->*_executeVector)(_image[address] << 8 | _image[(address + 1) & 0x0FFF]);
+    }
+    else
+    {
+        // Some lane wrote over this code, so each lane has to fetch its own copy
+        for (unsigned int lane = 0; lane < _lanes; ++lane)
+        {
+            if (_mask[lane])
+            {
+                const unsigned char *memory = &_memory[lane * 4096];
+                executeScalar(lane, memory[address] << 8 | memory[(address + 1) & 0x0FFF]);
+            }
+        }
+    }
+
+    if (!uniform)
+    {
+        // Lanes that have diverged are on their own
+        for (unsigned int lane = 0; lane < _lanes; ++lane)
+        {
+            if (!_mask[lane])
+            {
+                const unsigned short pc = _programCounter[lane] & 0x0FFF;
+                const unsigned char *memory = &_memory[lane * 4096];
+                executeScalar(lane, memory[pc] << 8 | memory[(pc + 1) & 0x0FFF]);
+            }
+        }
+    }
+
+    ++_instructions;
+}
+
+void lockstep::tickTimers()
+{
+    (this->*_countDownTimers)();
+}
+
+/// Lanes start with the same seed as chip8, give them different ones to make them diverge
+void lockstep::seed(const unsigned int lane, const uint64_t value)
+{
+    _random[lane] = pcg32Seed(value);
+}
+
+void lockstep::setKey(const unsigned int lane, const unsigned char key, const bool pressed)
+{
+    if (pressed)
+    {
+        _keys[lane] |= 1 << (key & 0xF);
+    }
+    else
+    {
+        _keys[lane] &= ~(1 << (key & 0xF));
+    }
+
+    if (pressed && _waitingForKey[lane])
+    {
+        // Finish the FX0A the lane is blocked on, like chip8::setKey()
+        const unsigned short pc = _programCounter[lane] & 0x0FFF;
+        _v[(_memory[lane * 4096 + pc] & 0x0F) * _lanes + lane] = key & 0xF;
+        _programCounter[lane] = pc + 2;
+        _waitingForKey[lane] = 0;
+    }
+}
+
+unsigned int lockstep::lanes() const
+{
+    return _lanes;
+}
+
+bool lockstep::usesAvx2() const
+{
+    return _avx2;
+}
+
+uint64_t lockstep::instructions() const
+{
+    return _instructions;
+}
+
+/// Same fingerprint chip8::stateHash() gives for a machine in the state of this lane
+uint64_t lockstep::stateHash(const unsigned int lane) const
+{
+    unsigned char v[16];
+    unsigned short stack[16];
+    uint64_t gfx[32];
+    for (int i = 0; i < 16; ++i)
+    {
+        v[i] = _v[i * _lanes + lane];
+        stack[i] = _stack[i * _lanes + lane];
+    }
+    for (int y = 0; y < 32; ++y)
+    {
+        gfx[y] = _gfx[y * _lanes + lane];
+    }
+
+    uint64_t hash = fnv1a(&_memory[lane * 4096], 4096);
+    hash = fnv1a(v, sizeof(v), hash);
+    hash = fnv1a(&_indexRegister[lane], sizeof(unsigned short), hash);
+    hash = fnv1a(&_programCounter[lane], sizeof(unsigned short), hash);
+    hash = fnv1a(stack, sizeof(stack), hash);
+    hash = fnv1a(&_stackPointer[lane], sizeof(unsigned short), hash);
+    hash = fnv1a(&_delayTimer[lane], sizeof(unsigned char), hash);
+    hash = fnv1a(&_soundTimer[lane], sizeof(unsigned char), hash);
+    return fnv1a(gfx, sizeof(gfx), hash);
+}
+
+uint64_t lockstep::gfxHash(const unsigned int lane) const
+{
+    uint64_t gfx[32];
+    for (int y = 0; y < 32; ++y)
+    {
+        gfx[y] = _gfx[y * _lanes + lane];
+    }
+    return fnv1a(gfx, sizeof(gfx));
+}
+/// The program counter shared by more than half the lanes, or some lane's program counter when none is
+unsigned short lockstep::commonAddress() const
+{
+    // Boyer-Moore majority vote, a lane at the candidate counts for it and any other lane against it
+    unsigned short candidate = _programCounter[0];
+    int votes = 0;
+    for (unsigned int lane = 0; lane < _lanes; ++lane)
+    {
+        if (votes == 0)
+        {
+            candidate = _programCounter[lane];
+        }
+        votes += _programCounter[lane] == candidate ? 1 : -1;
+    }
+    return candidate;
+}
+
+unsigned char *lockstep::v(const unsigned int reg)
+{
+    return &_v[reg * _lanes];
+}
+
+
+/// Execute one instruction in a single lane, following chip8::decode() and the chip8 handlers exactly
+void lockstep::executeScalar(const unsigned int lane, const unsigned short opcode)
+{
+    const unsigned int x = (opcode & 0x0F00) >> 8;
+    const unsigned int y = (opcode & 0x00F0) >> 4;
+    const unsigned char n = opcode & 0x000F;
+    const unsigned char nn = opcode & 0x00FF;
+    const unsigned short nnn = opcode & 0x0FFF;
+
+    unsigned char &vx = _v[x * _lanes + lane];
+    unsigned char &vy = _v[y * _lanes + lane];
+    unsigned char &vf = _v[0xF * _lanes + lane];
+    unsigned short &pc = _programCounter[lane];
+    unsigned short &indexRegister = _indexRegister[lane];
+
+    pc &= 0x0FFF;
+
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+        switch (n)
+        {
+        case 0x0:
+            for (int row = 0; row < 32; ++row)
+            {
+                _gfx[row * _lanes + lane] = 0;
+            }
+            pc += 2;
+            break;
+        case 0xE:
+            --_stackPointer[lane];
+            pc = _stack[(_stackPointer[lane] & 0xF) * _lanes + lane] + 2;
+            break;
+        }
+        break;
+
+    case 0x1000:
+        pc = nnn;
+        break;
+
+    case 0x2000:
+        _stack[(_stackPointer[lane] & 0xF) * _lanes + lane] = pc;
+        ++_stackPointer[lane];
+        pc = nnn;
+        break;
+
+    case 0x3000:
+        pc += vx == nn ? 4 : 2;
+        break;
+
+    case 0x4000:
+        pc += vx != nn ? 4 : 2;
+        break;
+
+    case 0x5000:
+        pc += vx == vy ? 4 : 2;
+        break;
+
+    case 0x6000:
+        vx = nn;
+        pc += 2;
+        break;
+
+    case 0x7000:
+        vx += nn;
+        pc += 2;
+        break;
+
+    case 0x8000:
+        switch (n)
+        {
+        case 0x0:
+            vx = vy;
+            break;
+        case 0x1:
+            vx |= vy;
+            break;
+        case 0x2:
+            vx &= vy;
+            break;
+        case 0x3:
+            vx ^= vy;
+            break;
+        case 0x4:
+            vf = vy > vx;
+            vx += vy;
+            break;
+        case 0x5:
+            vf = !(vy > vx);
+            vx -= vy;
+            break;
+        case 0x6:
+        {
+            // VF is stored last so the flag wins when X is F
+            const unsigned char flag = vx & 0x1;
+            vx >>= 1;
+            vf = flag;
+            break;
+        }
+        case 0x7:
+            vf = !(vx > vy);
+            vx = vy - vx;
+            break;
+        case 0xE:
+        {
+            const unsigned char flag = vx >> 7;
+            vx <<= 1;
+            vf = flag;
+            break;
+        }
+        default:
+            return;
+        }
+        pc += 2;
+        break;
+
+    case 0x9000:
+        pc += vx != vy ? 4 : 2;
+        break;
+
+    case 0xA000:
+        indexRegister = nnn;
+        pc += 2;
+        break;
+
+    case 0xB000:
+        pc = nnn + _v[lane];
+        break;
+
+    case 0xC000:
+        vx = nn & (pcg32(_random[lane]) & 0xFF);
+        pc += 2;
+        break;
+
+    case 0xD000:
+    {
+        const unsigned int left = vx & 63;
+        const unsigned int top = vy & 31;
+        const unsigned char *memory = &_memory[lane * 4096];
+        uint64_t collision = 0;
+        for (int row = 0; row < n; ++row)
+        {
+            const uint64_t sprite = rotateRight((uint64_t)memory[(indexRegister + row) & 0x0FFF] << 56, left);
+            uint64_t &line = _gfx[((top + row) & 31) * _lanes + lane];
+            collision |= line & sprite;
+            line ^= sprite;
+        }
+        vf = collision != 0;
+        pc += 2;
+        break;
+    }
+
+    case 0xE000:
+        switch (nn)
+        {
+        case 0x9E:
+            pc += (_keys[lane] >> (vx & 0xF)) & 1 ? 4 : 2;
+            break;
+        case 0xA1:
+            pc += (_keys[lane] >> (vx & 0xF)) & 1 ? 2 : 4;
+            break;
+        }
+        break;
+
+    case 0xF000:
+        switch (nn)
+        {
+        case 0x07:
+            vx = _delayTimer[lane];
+            pc += 2;
+            break;
+        case 0x0A:
+            // Block without moving on, setKey() finishes the instruction
+            _waitingForKey[lane] = 1;
+            break;
+        case 0x15:
+            _delayTimer[lane] = vx;
+            pc += 2;
+            break;
+        case 0x18:
+            _soundTimer[lane] = vx;
+            pc += 2;
+            break;
+        case 0x1E:
+            vf = indexRegister + vx > 0xFFF;
+            indexRegister += vx;
+            pc += 2;
+            break;
+        case 0x29:
+            indexRegister = (vx & 0xF) * 5;
+            pc += 2;
+            break;
+        case 0x33:
+            writeMemory(lane, indexRegister, vx / 100);
+            writeMemory(lane, indexRegister + 1, (vx / 10) % 10);
+            writeMemory(lane, indexRegister + 2, vx % 10);
+            pc += 2;
+            break;
+        case 0x55:
+            for (unsigned int i = 0; i <= x; ++i)
+            {
+                writeMemory(lane, indexRegister + i, _v[i * _lanes + lane]);
+            }
+            pc += 2;
+            break;
+        case 0x65:
+            for (unsigned int i = 0; i <= x; ++i)
+            {
+                _v[i * _lanes + lane] = _memory[lane * 4096 + ((indexRegister + i) & 0x0FFF)];
+            }
+            pc += 2;
+            break;
+        }
+        break;
+
+        // Bad opcodes do nothing, the lane stays on them like a halted chip8
+    }
+}
+
+void lockstep::writeMemory(const unsigned int lane, const unsigned short address, const unsigned char value)
+{
+    const unsigned short wrapped = address & 0x0FFF;
+    _memory[lane * 4096 + wrapped] = value;
+
+    // From now on lanes fetch their own copy of any instruction overlapping this byte
+    _written[wrapped] = true;
+}
@@ -0,0 +1,109 @@
+/// Lockstep engine that runs many copies of one Chip 8 program at once
+/// Registers, timers, stacks and screens of all instances (lanes) are stored structure-of-arrays,
+/// so one instruction can be applied to every lane with a handful of SIMD operations.
+///
+/// Every step the lanes that share the program counter of most lanes execute its instruction together,
+/// for the ALU, skip, jump, index and timer opcodes. Those vector kernels are built twice, once plain
+/// and once for AVX2 in lockstepavx2.cpp, and the AVX2 ones are picked when the CPU turns out to have it.
+/// Lanes whose program counter has diverged, and opcodes that touch memory, the screen or keys,
+/// are executed one lane at a time. A lane blocked in FX0A runs nothing until setKey() presses a key.
+///
+/// Each lane behaves exactly like a chip8 instance running the same program with the modern quirks.
+///
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include <vector>
+
+class lockstep
+{
+public:
+    /// The number of lanes is rounded up to a whole number of SIMD vectors
+    /// Pass allowAvx2 = false to run the plain kernels even where AVX2 is available.
+    lockstep(const unsigned int lanes, const bool allowAvx2 = true);
+
+    void init();
+    bool load(const char *path);
+
+    /// Execute one instruction in every lane
+    void step();
+
+    /// Count the timers of every lane down by one 60hz tick, call once per frame of steps
+    void tickTimers();
+
+    void seed(const unsigned int lane, const uint64_t value);
+    void setKey(const unsigned int lane, const unsigned char key, const bool pressed);
+
+    unsigned int lanes() const;
+    uint64_t instructions() const;
+    bool usesAvx2() const;
+    uint64_t stateHash(const unsigned int lane) const;
+    uint64_t gfxHash(const unsigned int lane) const;
+
+private:
+    /// Vector kernels, VECTOR is one of the structs in lockstep.cpp and lockstepavx2.cpp, see lockstepvector.h
+    template <typename VECTOR>
+    unsigned int markLeaders(const unsigned short address);
+    template <typename VECTOR>
+    void executeVector(const unsigned short opcode);
+    template <typename VECTOR>
+    void countDownTimers();
+
+    /// Point the kernels at the AVX2 ones, only defined when lockstepavx2.cpp is built
+    void useAvx2();
+
+    unsigned short commonAddress() const;
+    void executeScalar(const unsigned int lane, const unsigned short opcode);
+    void writeMemory(const unsigned int lane, const unsigned short address, const unsigned char value);
+
+    unsigned char *v(const unsigned int reg);
+
+    unsigned int _lanes;
+
+    /// The kernels step() and tickTimers() run, plain or AVX2
+    unsigned int (lockstep::*_markLeaders)(const unsigned short address);
+    void (lockstep::*_executeVector)(const unsigned short opcode);
+    void (lockstep::*_countDownTimers)();
+    bool _avx2;
+
+    /// Register R of lane L is at [R * lanes + L], so each register is a contiguous run of lanes
+    std::vector<unsigned char> _v;
+    std::vector<unsigned short> _indexRegister;
+    std::vector<unsigned short> _programCounter;
+    std::vector<unsigned short> _stack;
+    std::vector<unsigned short> _stackPointer;
+    std::vector<unsigned char> _delayTimer;
+    std::vector<unsigned char> _soundTimer;
+
+    /// Random number generator of each lane, see chip8::_random
+    std::vector<uint64_t> _random;
+
+    /// Pressed keys of each lane, bit K set while key K is down
+    std::vector<unsigned short> _keys;
+
+    /// Set for the lanes where an FX0A at the program counter waits for a key press, see chip8::_waitingForKey
+    std::vector<unsigned char> _waitingForKey;
+
+    /// Row Y of lane L is at [Y * lanes + L], laid out like chip8::_gfx
+    std::vector<uint64_t> _gfx;
+
+    /// 4KB of memory per lane, lane L starts at [L * 4096]
+    std::vector<unsigned char> _memory;
+
+    /// Memory as loaded, shared by all lanes as the place instructions are fetched from
+    unsigned char _image[4096];
+
+    /// Set for every address some lane has written to, instructions there are fetched per lane
+    bool _written[4096];
+
+    /// 0xFF for the lanes executing the current vector instruction, 0x00 for the rest
+    std::vector<unsigned char> _mask;
+
+    /// Scratch space for per lane skip conditions
+    std::vector<unsigned char> _condition;
+
+    uint64_t _instructions;
+};
+
+#endif
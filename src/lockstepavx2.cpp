@@ -0,0 +1,146 @@
+/// The lockstep kernels built for AVX2, only run once lockstep has checked the CPU has it
+/// This file alone is compiled with AVX2 enabled, see CMakeLists.txt. Keep it to the kernels, any
+/// inline function it pulls in from elsewhere may end up being the copy the linker keeps.
+///
+#include <immintrin.h>
+#include "lockstepvector.h"
+
+/// 32 lanes of 8-bit registers or 16 lanes of 16-bit ones in each 256-bit vector
+struct avx2Vector
+{
+    /// Number of lanes one vector covers when holding 8-bit and 16-bit registers
+    static const unsigned int BYTE_LANES = 32;
+    static const unsigned int WORD_LANES = 16;
+
+    typedef __m256i vec;
+
+    static vec loadBytes(const unsigned char *lanes)
+    {
+        return _mm256_loadu_si256((const __m256i *)lanes);
+    }
+
+    static void storeBytes(unsigned char *lanes, const vec value)
+    {
+        _mm256_storeu_si256((__m256i *)lanes, value);
+    }
+
+    static vec loadWords(const unsigned short *lanes)
+    {
+        return _mm256_loadu_si256((const __m256i *)lanes);
+    }
+
+    static void storeWords(unsigned short *lanes, const vec value)
+    {
+        _mm256_storeu_si256((__m256i *)lanes, value);
+    }
+
+    /// Load WORD_LANES byte masks widened to word masks
+    static vec loadMaskWords(const unsigned char *mask)
+    {
+        return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)mask));
+    }
+
+    static vec bytes(const unsigned char value)
+    {
+        return _mm256_set1_epi8((char)value);
+    }
+
+    static vec words(const unsigned short value)
+    {
+        return _mm256_set1_epi16((short)value);
+    }
+
+    /// mask ? a : b for every lane
+    static vec select(const vec mask, const vec a, const vec b)
+    {
+        return _mm256_blendv_epi8(b, a, mask);
+    }
+
+    static vec andBits(const vec a, const vec b)
+    {
+        return _mm256_and_si256(a, b);
+    }
+
+    static vec orBits(const vec a, const vec b)
+    {
+        return _mm256_or_si256(a, b);
+    }
+
+    static vec xorBits(const vec a, const vec b)
+    {
+        return _mm256_xor_si256(a, b);
+    }
+
+    static vec addBytes(const vec a, const vec b)
+    {
+        return _mm256_add_epi8(a, b);
+    }
+
+    static vec subBytes(const vec a, const vec b)
+    {
+        return _mm256_sub_epi8(a, b);
+    }
+
+    static vec addWords(const vec a, const vec b)
+    {
+        return _mm256_add_epi16(a, b);
+    }
+
+    static vec equalBytes(const vec a, const vec b)
+    {
+        return _mm256_cmpeq_epi8(a, b);
+    }
+
+    /// a > b for unsigned bytes
+    static vec aboveBytes(const vec a, const vec b)
+    {
+        return xorBits(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), bytes(0xFF));
+    }
+
+    /// There is no byte shift, so shift words and mask off the bits that crossed over
+    static vec shiftRightBytes(const vec a)
+    {
+        return andBits(_mm256_srli_epi16(a, 1), bytes(0x7F));
+    }
+
+    static vec topBitBytes(const vec a)
+    {
+        return andBits(_mm256_srli_epi16(a, 7), bytes(0x01));
+    }
+
+    /// Count down towards zero without wrapping
+    static vec decrementBytes(const vec a)
+    {
+        return _mm256_subs_epu8(a, bytes(1));
+    }
+
+    /// Mask the BYTE_LANES lanes from programCounter on that are at address, wrapping their program counters to 12 bits
+    /// like chip8::cycle() does, and count them
+    static unsigned int markLanes(unsigned short *programCounter, unsigned char *mask, const unsigned short address)
+    {
+        const vec wrap = words(0x0FFF);
+        const vec target = words(address);
+        const vec lowPc = andBits(loadWords(programCounter), wrap);
+        const vec highPc = andBits(loadWords(programCounter + WORD_LANES), wrap);
+        storeWords(programCounter, lowPc);
+        storeWords(programCounter + WORD_LANES, highPc);
+
+        const vec low = _mm256_cmpeq_epi16(lowPc, target);
+        const vec high = _mm256_cmpeq_epi16(highPc, target);
+
+        // Packing works within 128-bit halves, put the lanes back in order afterwards
+        const vec lanes = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+        storeBytes(mask, lanes);
+        return __builtin_popcount(_mm256_movemask_epi8(lanes));
+    }
+};
+
+LOCKSTEP_INSTANTIATE(avx2Vector)
+
+void lockstep::useAvx2()
+{
+    _markLeaders = &lockstep::markLeaders<avx2Vector>;
+    _executeVector = &lockstep::executeVector<avx2Vector>;
+    _countDownTimers = &lockstep::countDownTimers<avx2Vector>;
+    _avx2 = true;
+}
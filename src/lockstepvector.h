@@ -0,0 +1,247 @@
+/// Kernels of the lockstep engine that run lanes as vectors
+/// Included by lockstep.cpp, which instantiates them with plain one-lane "vectors", and by
+/// lockstepavx2.cpp, which is built for AVX2 and instantiates them with 32 lanes at a time.
+/// VECTOR is a struct of static functions working on a vector of lanes, see either file.
+///
+#ifndef LOCKSTEPVECTOR_H
+#define LOCKSTEPVECTOR_H
+
+#include "lockstep.h"
+
+/// Set the mask for every lane whose program counter is at address
+/// Returns how many lanes that is
+template <typename VECTOR>
+unsigned int lockstep::markLeaders(const unsigned short address)
+{
+    unsigned int count = 0;
+    for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+    {
+        count += VECTOR::markLanes(&_programCounter[lane], &_mask[lane], address);
+    }
+    return count;
+}
+
+/// Execute one instruction in every masked lane
+/// Register only opcodes run across whole vectors, the rest fall back to one lane at a time
+template <typename VECTOR>
+void lockstep::executeVector(const unsigned short opcode)
+{
+    typedef typename VECTOR::vec vec;
+
+    unsigned char *vx = v((opcode & 0x0F00) >> 8);
+    unsigned char *vy = v((opcode & 0x00F0) >> 4);
+    unsigned char *vf = v(0xF);
+    const unsigned char nn = opcode & 0x00FF;
+    const unsigned short nnn = opcode & 0x0FFF;
+
+    // How the program counter moves afterwards
+    enum
+    {
+        ADVANCE,
+        SKIP,
+        JUMP,
+        SCALAR
+    } next = ADVANCE;
+
+    switch (opcode & 0xF000)
+    {
+    case 0x1000:
+        next = JUMP;
+        break;
+
+    case 0x3000:
+    case 0x4000:
+    {
+        // Not equal is equal flipped
+        const vec flip = VECTOR::bytes((opcode & 0xF000) == 0x4000 ? 0xFF : 0x00);
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+        {
+            VECTOR::storeBytes(&_condition[lane], VECTOR::xorBits(VECTOR::equalBytes(VECTOR::loadBytes(vx + lane), VECTOR::bytes(nn)), flip));
+        }
+        next = SKIP;
+        break;
+    }
+
+    case 0x5000:
+    case 0x9000:
+    {
+        const vec flip = VECTOR::bytes((opcode & 0xF000) == 0x9000 ? 0xFF : 0x00);
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+        {
+            VECTOR::storeBytes(&_condition[lane], VECTOR::xorBits(VECTOR::equalBytes(VECTOR::loadBytes(vx + lane), VECTOR::loadBytes(vy + lane)), flip));
+        }
+        next = SKIP;
+        break;
+    }
+
+    case 0x6000:
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+        {
+            const vec mask = VECTOR::loadBytes(&_mask[lane]);
+            VECTOR::storeBytes(vx + lane, VECTOR::select(mask, VECTOR::bytes(nn), VECTOR::loadBytes(vx + lane)));
+        }
+        break;
+
+    case 0x7000:
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+        {
+            const vec mask = VECTOR::loadBytes(&_mask[lane]);
+            const vec x = VECTOR::loadBytes(vx + lane);
+            VECTOR::storeBytes(vx + lane, VECTOR::select(mask, VECTOR::addBytes(x, VECTOR::bytes(nn)), x));
+        }
+        break;
+
+    case 0x8000:
+        // VF is written first and the operands are loaded again afterwards, because X or Y may be F
+        for (unsigned int lane = 0; lane < _lanes && next != SCALAR; lane += VECTOR::BYTE_LANES)
+        {
+            const vec mask = VECTOR::loadBytes(&_mask[lane]);
+            vec x = VECTOR::loadBytes(vx + lane);
+            vec y = VECTOR::loadBytes(vy + lane);
+            const vec f = VECTOR::loadBytes(vf + lane);
+
+            switch (opcode & 0x000F)
+            {
+            case 0x0000:
+                x = y;
+                break;
+            case 0x0001:
+                x = VECTOR::orBits(x, y);
+                break;
+            case 0x0002:
+                x = VECTOR::andBits(x, y);
+                break;
+            case 0x0003:
+                x = VECTOR::xorBits(x, y);
+                break;
+            case 0x0004:
+                VECTOR::storeBytes(vf + lane, VECTOR::select(mask, VECTOR::andBits(VECTOR::aboveBytes(y, x), VECTOR::bytes(1)), f));
+                x = VECTOR::addBytes(VECTOR::loadBytes(vx + lane), VECTOR::loadBytes(vy + lane));
+                break;
+            case 0x0005:
+                VECTOR::storeBytes(vf + lane, VECTOR::select(mask, VECTOR::andBits(VECTOR::xorBits(VECTOR::aboveBytes(y, x), VECTOR::bytes(0xFF)), VECTOR::bytes(1)), f));
+                x = VECTOR::subBytes(VECTOR::loadBytes(vx + lane), VECTOR::loadBytes(vy + lane));
+                break;
+            case 0x0006:
+                // Shifts store VX before VF, like chip8, so the flag wins when X is F
+                VECTOR::storeBytes(vx + lane, VECTOR::select(mask, VECTOR::shiftRightBytes(x), x));
+                VECTOR::storeBytes(vf + lane, VECTOR::select(mask, VECTOR::andBits(x, VECTOR::bytes(1)), VECTOR::loadBytes(vf + lane)));
+                continue;
+            case 0x0007:
+                VECTOR::storeBytes(vf + lane, VECTOR::select(mask, VECTOR::andBits(VECTOR::xorBits(VECTOR::aboveBytes(x, y), VECTOR::bytes(0xFF)), VECTOR::bytes(1)), f));
+                x = VECTOR::subBytes(VECTOR::loadBytes(vy + lane), VECTOR::loadBytes(vx + lane));
+                break;
+            case 0x000E:
+                VECTOR::storeBytes(vx + lane, VECTOR::select(mask, VECTOR::addBytes(x, x), x));
+                VECTOR::storeBytes(vf + lane, VECTOR::select(mask, VECTOR::topBitBytes(x), VECTOR::loadBytes(vf + lane)));
+                continue;
+            default:
+                next = SCALAR;
+                continue;
+            }
+
+            VECTOR::storeBytes(vx + lane, VECTOR::select(mask, x, VECTOR::loadBytes(vx + lane)));
+        }
+        break;
+
+    case 0xA000:
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::WORD_LANES)
+        {
+            const vec mask = VECTOR::loadMaskWords(&_mask[lane]);
+            VECTOR::storeWords(&_indexRegister[lane], VECTOR::select(mask, VECTOR::words(nnn), VECTOR::loadWords(&_indexRegister[lane])));
+        }
+        break;
+
+    case 0xF000:
+        switch (opcode & 0x00FF)
+        {
+        case 0x0007:
+            for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+            {
+                const vec mask = VECTOR::loadBytes(&_mask[lane]);
+                VECTOR::storeBytes(vx + lane, VECTOR::select(mask, VECTOR::loadBytes(&_delayTimer[lane]), VECTOR::loadBytes(vx + lane)));
+            }
+            break;
+        case 0x0015:
+            for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+            {
+                const vec mask = VECTOR::loadBytes(&_mask[lane]);
+                VECTOR::storeBytes(&_delayTimer[lane], VECTOR::select(mask, VECTOR::loadBytes(vx + lane), VECTOR::loadBytes(&_delayTimer[lane])));
+            }
+            break;
+        case 0x0018:
+            for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+            {
+                const vec mask = VECTOR::loadBytes(&_mask[lane]);
+                VECTOR::storeBytes(&_soundTimer[lane], VECTOR::select(mask, VECTOR::loadBytes(vx + lane), VECTOR::loadBytes(&_soundTimer[lane])));
+            }
+            break;
+        default:
+            next = SCALAR;
+        }
+        break;
+
+    default:
+        next = SCALAR;
+    }
+
+    switch (next)
+    {
+    case ADVANCE:
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::WORD_LANES)
+        {
+            const vec mask = VECTOR::loadMaskWords(&_mask[lane]);
+            const vec pc = VECTOR::loadWords(&_programCounter[lane]);
+            VECTOR::storeWords(&_programCounter[lane], VECTOR::select(mask, VECTOR::addWords(pc, VECTOR::words(2)), pc));
+        }
+        break;
+
+    case SKIP:
+        // Move on by 2, or by 4 where the condition holds
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::WORD_LANES)
+        {
+            const vec mask = VECTOR::loadMaskWords(&_mask[lane]);
+            const vec skip = VECTOR::andBits(VECTOR::loadMaskWords(&_condition[lane]), VECTOR::words(2));
+            const vec pc = VECTOR::loadWords(&_programCounter[lane]);
+            VECTOR::storeWords(&_programCounter[lane], VECTOR::select(mask, VECTOR::addWords(pc, VECTOR::addWords(VECTOR::words(2), skip)), pc));
+        }
+        break;
+
+    case JUMP:
+        for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::WORD_LANES)
+        {
+            const vec mask = VECTOR::loadMaskWords(&_mask[lane]);
+            VECTOR::storeWords(&_programCounter[lane], VECTOR::select(mask, VECTOR::words(nnn), VECTOR::loadWords(&_programCounter[lane])));
+        }
+        break;
+
+    case SCALAR:
+        for (unsigned int lane = 0; lane < _lanes; ++lane)
+        {
+            if (_mask[lane])
+            {
+                executeScalar(lane, opcode);
+            }
+        }
+        break;
+    }
+}
+
+/// One 60hz timer tick in every lane, see chip8::tickTimers()
+template <typename VECTOR>
+void lockstep::countDownTimers()
+{
+    for (unsigned int lane = 0; lane < _lanes; lane += VECTOR::BYTE_LANES)
+    {
+        VECTOR::storeBytes(&_delayTimer[lane], VECTOR::decrementBytes(VECTOR::loadBytes(&_delayTimer[lane])));
+        VECTOR::storeBytes(&_soundTimer[lane], VECTOR::decrementBytes(VECTOR::loadBytes(&_soundTimer[lane])));
+    }
+}
+
+/// Every kernel for one VECTOR
+#define LOCKSTEP_INSTANTIATE(VECTOR)                                                \
+    template unsigned int lockstep::markLeaders<VECTOR>(const unsigned short address); \
+    template void lockstep::executeVector<VECTOR>(const unsigned short opcode);      \
+    template void lockstep::countDownTimers<VECTOR>();
+
+#endif
@@ -1,21 +1,565 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <glut.h>
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+#include "buzzer.h"
+#include "chip8.h"
+#include "inputlog.h"
+#include "rewindbuffer.h"
+#include "scaler.h"
+#include "triplebuffer.h"
+
+const int SCREEN_WIDTH = 64;
+const int SCREEN_HEIGHT = 32;
+
+/// Window pixels per Chip 8 pixel
+const int DISPLAY_SCALE = 10;
+
+chip8 myChip8;
+
+scaler screenScaler(DISPLAY_SCALE);
+
+/// The Chip 8 screen at window size as RGBA, redrawn by screenScaler when it changes
+uint32_t screen[SCREEN_WIDTH * DISPLAY_SCALE * SCREEN_HEIGHT * DISPLAY_SCALE];
+
+GLuint screenTexture;
+
+/// A finished frame handed from the emulation thread to the renderer
+struct frame
+{
+    uint64_t gfx[32];
+
+    /// Time stamp of the oldest key event that went into this frame, 0 if none did
+    uint64_t inputTime;
+};
+
+tripleBuffer<frame> frames;
+
+/// The screen as last rendered, to find out what a new frame changed
+uint64_t shown[32];
+
+/// How often the renderer looks for a new frame
+const unsigned int PRESENT_INTERVAL_MS = 4;
+
+/// Key events from the GLUT thread to the emulation thread
+keyQueue input;
+
+/// Keys recorded with -s or replayed with -i, both only touched by the emulation thread once it runs
+/// While either is going the keys go through the log between frames instead of straight into the machine.
+inputLog keyLog;
+const char *recordPath = nullptr;
+bool replaying = false;
+
+/// The last few seconds of frames, stepped back through one per frame while REWIND_KEY is held
+/// Left alone while keys are recorded or replayed, a log can't go back in time.
+rewindBuffer history;
+std::atomic<bool> rewinding(false);
+
+/// Backspace
+const unsigned char REWIND_KEY = 8;
+
+/// Time stamp of the oldest key event in the frame about to be shown, see display()
+uint64_t pendingInputTime = 0;
+
+/// Time from key event to the frame showing it on screen
+uint64_t latencyEvents = 0;
+uint64_t latencyTotal = 0;
+uint64_t latencyMax = 0;
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+/// Command the buzzer's raw samples are piped to with -a, e.g. "aplay -q -f S16_LE -r 44100 -c 1"
+FILE *audioSink = nullptr;
+
+/// Buzzer samples from the emulation thread to the audio thread
+sampleQueue audio;
+
+/// Only used by the emulation thread
+buzzer synth;
+std::vector<chip8::soundEvent> sounds;
+std::vector<int16_t> samples;
+
+/// Samples the audio thread writes to the sink at a time
+const size_t AUDIO_CHUNK = 256;
+
+void setupTexture()
+{
+    glGenTextures(1, &screenTexture);
+    glBindTexture(GL_TEXTURE_2D, screenTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, screenScaler.width());
+    screenScaler.render(shown, screen, screenScaler.width());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screenScaler.width(), screenScaler.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, screen);
+    glEnable(GL_TEXTURE_2D);
+}
+
+/// Redraw the screen from the newest frame and upload the parts of it that changed
+/// Runs on the GLUT thread, frames published in between are never seen.
+void present(int)
+{
+    const bool wasFading = screenScaler.fading();
+    if (frames.update() || wasFading)
+    {
+        const frame &latest = frames.front();
+        if (pendingInputTime == 0)
+        {
+            pendingInputTime = latest.inputTime;
+        }
+
+        uint64_t changed[32];
+        for (int y = 0; y < 32; ++y)
+        {
+            changed[y] = latest.gfx[y] ^ shown[y];
+            shown[y] = latest.gfx[y];
+        }
+
+        screenScaler.render(shown, screen, screenScaler.width());
+
+        const unsigned int scale = screenScaler.scale();
+        if (wasFading || screenScaler.fading())
+        {
+            // Fading pixels change everywhere, not just where the emulator drew
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, screenScaler.width(), screenScaler.height(), GL_RGBA, GL_UNSIGNED_BYTE, screen);
+        }
+        else
+        {
+            // Rows of a region are a whole screen width apart, see GL_UNPACK_ROW_LENGTH
+            const std::vector<chip8::rect> regions = chip8::changedRegions(changed);
+            for (size_t i = 0; i < regions.size(); ++i)
+            {
+                const chip8::rect &region = regions[i];
+                glTexSubImage2D(GL_TEXTURE_2D, 0, region.x * scale, region.y * scale, region.width * scale, region.height * scale, GL_RGBA, GL_UNSIGNED_BYTE,
+                                screen + region.y * scale * screenScaler.width() + region.x * scale);
+            }
+        }
+
+        glutPostRedisplay();
+    }
+
+    glutTimerFunc(PRESENT_INTERVAL_MS, present, 0);
+}
+
+void display()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Texture row 0 is the top of the Chip 8 screen
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 1.0f);
+    glVertex2f(-1.0f, -1.0f);
+    glTexCoord2f(1.0f, 1.0f);
+    glVertex2f(1.0f, -1.0f);
+    glTexCoord2f(1.0f, 0.0f);
+    glVertex2f(1.0f, 1.0f);
+    glTexCoord2f(0.0f, 0.0f);
+    glVertex2f(-1.0f, 1.0f);
+    glEnd();
+
+    glutSwapBuffers();
+
+    if (pendingInputTime != 0)
+    {
+        const uint64_t latency = inputTime() - pendingInputTime;
+        pendingInputTime = 0;
+        ++latencyEvents;
+        latencyTotal += latency;
+        latencyMax = latency > latencyMax ? latency : latencyMax;
+    }
+}
+
+void reshape(int width, int height)
+{
+    glViewport(0, 0, width, height);
+}
+
+/// Keyboard keys for Chip 8 keys 0-F, laid out as the 4x4 keypad on the left of a QWERTY keyboard
+const unsigned char KEYMAP[16] = {'x', '1', '2', '3', 'q', 'w', 'e', 'a', 's', 'd', 'z', 'c', '4', 'r', 'f', 'v'};
+
+const std::chrono::steady_clock::duration FRAME_TIME = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / 60));
+
+std::atomic<bool> running(true);
+std::mutex wakeMutex;
+std::condition_variable wake;
+std::thread emulator;
+std::thread speaker;
+
+/// Emulation thread, runs 60hz frames on a fixed schedule and publishes every frame that drew something
+/// Nothing here waits for the renderer, so a slow display drops frames instead of slowing the program.
+void emulate()
+{
+    std::chrono::steady_clock::time_point nextFrame = std::chrono::steady_clock::now();
+
+    while (running.load())
+    {
+        if (replaying)
+        {
+            keyLog.replay(myChip8);
+
+            // The keyboard takes over once the log runs out, keys pressed before then are dropped
+            // With -s as well the recording carries on from the end of the replay
+            keyEvent ignored;
+            while (input.pop(ignored))
+            {
+            }
+            if (keyLog.finished())
+            {
+                replaying = false;
+                myChip8.setInputQueue(recordPath == nullptr ? &input : nullptr);
+            }
+        }
+        else if (recordPath != nullptr)
+        {
+            keyEvent event;
+            while (input.pop(event))
+            {
+                keyLog.apply(myChip8, event.key, event.pressed);
+            }
+        }
+        myChip8.pollInput();
+        const bool keepHistory = !replaying && recordPath == nullptr;
+        const bool rewound = keepHistory && rewinding.load();
+
+        // Sleep until a key arrives, rather than running empty frames
+        if (myChip8.parked() && !rewound)
+        {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [keepHistory]
+                      { return !running.load() || !input.empty() || (keepHistory && rewinding.load()); });
+            nextFrame = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        // Catch up if the host fell behind, but never by more than a few frames
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - nextFrame > FRAME_TIME * 4)
+        {
+            nextFrame = now;
+        }
+        const uint64_t first = myChip8.instructions();
+        if (rewound)
+        {
+            // Restoring can switch the buzzer, which has nothing to play while time runs backwards
+            history.stepBack(myChip8);
+            sounds.clear();
+        }
+        else
+        {
+            myChip8.runFrame();
+            if (keepHistory)
+            {
+                history.record(myChip8);
+            }
+        }
+
+        if (audioSink != nullptr && !rewound)
+        {
+            // A full queue means the sink has stalled, better to skip samples than the frame
+            synth.renderFrame(sounds, first, myChip8.instructions(), samples);
+            for (size_t i = 0; i < samples.size() && audio.push(samples[i]); ++i)
+            {
+            }
+            sounds.clear();
+            samples.clear();
+        }
+
+        if (myChip8.drawFlag())
+        {
+            memcpy(frames.back().gfx, myChip8.gfx(), sizeof(frame::gfx));
+            frames.back().inputTime = myChip8.takeInputTime();
+            myChip8.setDrawFlag(false);
+            frames.publish();
+        }
+
+        // Frames are due on a fixed schedule rather than a fixed delay after the last one, so they don't drift
+        nextFrame += FRAME_TIME;
+        std::this_thread::sleep_until(nextFrame);
+    }
+}
+
+/// Audio thread, writes samples to the sink as fast as it takes them
+/// The sink plays them at its own sample rate and blocks once its buffer is full, which paces
+/// this thread. Silence fills in when the emulator has nothing, such as while it is parked.
+void playAudio()
+{
+    int16_t chunk[AUDIO_CHUNK];
+    while (running.load())
+    {
+        size_t count = 0;
+        for (int wait = 0; count < AUDIO_CHUNK && wait < 20;)
+        {
+            if (audio.pop(chunk[count]))
+            {
+                ++count;
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                ++wait;
+            }
+        }
+        if (count == 0)
+        {
+            memset(chunk, 0, sizeof(chunk));
+            count = AUDIO_CHUNK;
+        }
+
+        // Samples go out in host byte order
+        if (fwrite(chunk, sizeof(int16_t), count, audioSink) != count)
+        {
+            return;
+        }
+        fflush(audioSink);
+    }
+}
+
+void stopEmulation()
+{
+    running.store(false);
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wake.notify_all();
+    }
+    if (emulator.joinable())
+    {
+        emulator.join();
+    }
+    if (speaker.joinable())
+    {
+        speaker.join();
+    }
+    if (audioSink != nullptr)
+    {
+        pclose(audioSink);
+    }
+    if (recordPath != nullptr && keyLog.save(recordPath))
+    {
+        fprintf(stderr, "Recorded %zu key events to %s\n", keyLog.events().size(), recordPath);
+    }
+
+    if (latencyEvents != 0)
+    {
+        fprintf(stderr, "Input to screen latency over %" PRIu64 " frames: mean %.1fms, worst %.1fms\n",
+                latencyEvents, latencyTotal / 1e6 / latencyEvents, latencyMax / 1e6);
+    }
+}
+
+/// Chip 8 key for a keyboard key, or -1 if it isn't mapped
+int keypadKey(unsigned char key)
+{
+    if (key >= 'A' && key <= 'Z')
+    {
+        key += 'a' - 'A';
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        if (KEYMAP[i] == key)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void keyDown(unsigned char key, int, int)
+{
+    if (key == REWIND_KEY)
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        rewinding.store(true);
+        wake.notify_one();
+        return;
+    }
+
+    const int pressed = keypadKey(key);
+    if (pressed < 0)
+    {
+        return;
+    }
+
+    // Dropping a key when the queue is full is better than stalling the window
+    keyEvent event = {inputTime(), (unsigned char)pressed, true};
+    input.push(event);
+
+    // Wake the emulation thread if it is waiting for a key
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    wake.notify_one();
+}
+
+void keyUp(unsigned char key, int, int)
+{
+    if (key == REWIND_KEY)
+    {
+        rewinding.store(false);
+        return;
+    }
+
+    const int released = keypadKey(key);
+    if (released >= 0)
+    {
+        keyEvent event = {inputTime(), (unsigned char)released, false};
+        input.push(event);
+    }
+}
+
+#ifdef CHIP8_PROFILE
+/// Where the heatmap of executed addresses is written when the emulator exits
+const char *HEATMAP_PATH = "chip8-heatmap.pgm";
+
+/// glutMainLoop() never returns, so the profile is written on the way out of the process
+void writeProfile()
+{
+    myChip8.profile().report(stderr);
+    myChip8.profile().writeHeatmap(HEATMAP_PATH);
+}
+#endif
+
+const char *USAGE = "Usage: chip8 <program> [-r instructions per second, 0 for unlimited] [-p offRGB,onRGB] [-l scanline brightness] [-g ghosting] [-a audio command] [-q vip|schip|modern] [-s record keys to] [-i replay keys from]\n";
 
 int main(int argc, char **argv)
 {
+    if (argc < 2)
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
     // Set-up graphics
-    // Set-up input
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
+    glutInitWindowSize(SCREEN_WIDTH * DISPLAY_SCALE, SCREEN_HEIGHT * DISPLAY_SCALE);
+    glutCreateWindow("Chip 8");
+    glutDisplayFunc(display);
+    glutReshapeFunc(reshape);
+
+    // Set-up input, key repeat would look like the key being pressed again
+    glutIgnoreKeyRepeat(1);
+    glutKeyboardFunc(keyDown);
+    glutKeyboardUpFunc(keyUp);
+
+    // Initialise Chip 8 system, the core is deterministic so give each interactive session its own randomness
+    myChip8.init();
+    myChip8.seed(time(NULL));
+    const char *replayPath = nullptr;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            // strtoul() gives 0 for junk, which would quietly mean unlimited
+            char *end;
+            const unsigned long rate = strtoul(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != '\0')
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+            myChip8.setInstructionRate(rate);
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            unsigned int off;
+            unsigned int on;
+            if (sscanf(argv[i + 1], "%x,%x", &off, &on) == 2)
+            {
+                screenScaler.setPalette(off, on);
+            }
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            screenScaler.setScanlines(atoi(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "-g") == 0)
+        {
+            screenScaler.setGhosting(atoi(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            quirks preset;
+            if (!parseQuirks(argv[i + 1], preset))
+            {
+                fputs(USAGE, stderr);
+                return 1;
+            }
+            myChip8.setQuirks(preset);
+        }
+        else if (strcmp(argv[i], "-a") == 0)
+        {
+            // Raw signed 16-bit mono samples at DEFAULT_SAMPLE_RATE go to the command's standard input
+            audioSink = popen(argv[i + 1], "w");
+            if (audioSink == nullptr)
+            {
+                fprintf(stderr, "Could not run %s\n", argv[i + 1]);
+            }
+            else
+            {
+                myChip8.setSoundLog(&sounds);
+            }
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            recordPath = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            replayPath = argv[i + 1];
+        }
+    }
+
+    setupTexture();
 
-    // Initialise Chip 8 system
     // Load game into memory
+    if (!myChip8.load(argv[1]))
+    {
+        return 1;
+    }
 
-    // Perform emulation loop
-    for (;;)
+    // A replay only matches its recording when run with the same -r and -q, and a fixed rate
+    if (replayPath != nullptr)
     {
-        // Tick
+        if (!keyLog.load(replayPath))
+        {
+            return 1;
+        }
+        keyLog.rewind(myChip8);
+        replaying = true;
+    }
+    else if (recordPath != nullptr)
+    {
+        keyLog.begin(myChip8, time(NULL));
+    }
+    else
+    {
+        myChip8.setInputQueue(&input);
+    }
 
-        // If draw flag set, update screen
+#ifdef CHIP8_PROFILE
+    atexit(writeProfile);
+#endif
 
-        // Store key press state (press and release)
+    // Emulate on a thread of its own, GLUT keeps this one for drawing and input
+    // Registered after the profile so the thread has stopped by the time the profile is written
+    emulator = std::thread(emulate);
+    if (audioSink != nullptr)
+    {
+        speaker = std::thread(playAudio);
     }
+    atexit(stopEmulation);
+
+    glutTimerFunc(0, present, 0);
+    glutMainLoop();
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,224 @@
+#include "profiler.h"
+#include <algorithm>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+/// Names of the opcode families that don't need the low bits to tell them apart
+const char *FAMILY_NAMES[16] = {"", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN", "", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "", ""};
+
+/// Print the name of a family as returned by profiler::family()
+static void printFamily(FILE *file, const unsigned short family)
+{
+    const unsigned int high = family >> 8;
+    const unsigned int low = family & 0xFF;
+    switch (high)
+    {
+    case 0x0:
+        // Decoding only looks at the low nibble, which is how 0x0NN0 ends up as 00E0
+        if (low == 0x0)
+        {
+            fputs("00E0", file);
+        }
+        else if (low == 0xE)
+        {
+            fputs("00EE", file);
+        }
+        else
+        {
+            fprintf(file, "0NN%X", low);
+        }
+        break;
+    case 0x8:
+        fprintf(file, "8XY%X", low);
+        break;
+    case 0xE:
+    case 0xF:
+        fprintf(file, "%XX%02X", high, low);
+        break;
+    default:
+        fputs(FAMILY_NAMES[high], file);
+    }
+}
+
+/// Indices of the non-zero counters, largest count first
+static std::vector<unsigned short> busiest(const uint64_t *counts, const unsigned int size)
+{
+    std::vector<unsigned short> order;
+    for (unsigned int i = 0; i < size; ++i)
+    {
+        if (counts[i] != 0)
+        {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [counts](const unsigned short a, const unsigned short b)
+                     { return counts[a] > counts[b]; });
+    return order;
+}
+
+profiler::profiler()
+{
+    clear();
+}
+
+void profiler::clear()
+{
+    _instructions = 0;
+    memset(_families, 0, sizeof(_families));
+    memset(_addresses, 0, sizeof(_addresses));
+    memset(_opcodes, 0, sizeof(_opcodes));
+    memset(_calls, 0, sizeof(_calls));
+    _last = 0;
+    _straight = 0;
+    memset(_pairs, 0, sizeof(_pairs));
+    memset(_triples, 0, sizeof(_triples));
+    _draws = 0;
+    _drawnRows = 0;
+}
+
+unsigned short profiler::family(const unsigned short opcode)
+{
+    const unsigned int high = opcode >> 12;
+    switch (high)
+    {
+    case 0x0:
+    case 0x8:
+        return high << 8 | (opcode & 0x000F);
+    case 0xE:
+    case 0xF:
+        return high << 8 | (opcode & 0x00FF);
+    default:
+        return high << 8;
+    }
+}
+
+void profiler::instruction(const unsigned short address, const unsigned short opcode)
+{
+    ++_instructions;
+    ++_families[family(opcode)];
+    ++_addresses[address & 0x0FFF];
+    _opcodes[address & 0x0FFF] = opcode;
+
+    _straight = (address & 0x0FFF) == ((_last + 2) & 0x0FFF) ? _straight + 1 : 1;
+    _last = address & 0x0FFF;
+    if (_straight >= 2)
+    {
+        ++_pairs[(_last - 2) & 0x0FFF];
+    }
+    if (_straight >= 3)
+    {
+        ++_triples[(_last - 4) & 0x0FFF];
+    }
+
+    switch (opcode & 0xF000)
+    {
+    case 0x2000:
+        ++_calls[opcode & 0x0FFF];
+        break;
+    case 0xD000:
+        ++_draws;
+        _drawnRows += opcode & 0x000F;
+        break;
+    }
+}
+
+void profiler::merge(const profiler &other)
+{
+    _instructions += other._instructions;
+    for (int i = 0; i < 4096; ++i)
+    {
+        _families[i] += other._families[i];
+        _addresses[i] += other._addresses[i];
+        _calls[i] += other._calls[i];
+        _pairs[i] += other._pairs[i];
+        _triples[i] += other._triples[i];
+        if (other._addresses[i] != 0)
+        {
+            _opcodes[i] = other._opcodes[i];
+        }
+    }
+    _draws += other._draws;
+    _drawnRows += other._drawnRows;
+}
+
+void profiler::report(FILE *file, const unsigned int top) const
+{
+    const double total = _instructions != 0 ? (double)_instructions : 1.0;
+
+    fprintf(file, "Instructions: %" PRIu64 "\n", _instructions);
+    fprintf(file, "Sprite draws: %" PRIu64 " (%" PRIu64 " rows)\n", _draws, _drawnRows);
+
+    fputs("\nOpcode families\n", file);
+    const std::vector<unsigned short> families = busiest(_families, 4096);
+    for (size_t i = 0; i < families.size(); ++i)
+    {
+        fputs("  ", file);
+        printFamily(file, families[i]);
+        fprintf(file, " %14" PRIu64 " %6.2f%%\n", _families[families[i]], _families[families[i]] * 100.0 / total);
+    }
+
+    fputs("\nHot addresses\n", file);
+    const std::vector<unsigned short> addresses = busiest(_addresses, 4096);
+    for (size_t i = 0; i < addresses.size() && i < top; ++i)
+    {
+        const unsigned short address = addresses[i];
+        fprintf(file, "  0x%03X %04X %14" PRIu64 " %6.2f%%\n", address, _opcodes[address], _addresses[address], _addresses[address] * 100.0 / total);
+    }
+
+    fputs("\nSubroutine calls\n", file);
+    const std::vector<unsigned short> calls = busiest(_calls, 4096);
+    for (size_t i = 0; i < calls.size() && i < top; ++i)
+    {
+        fprintf(file, "  0x%03X %14" PRIu64 "\n", calls[i], _calls[calls[i]]);
+    }
+}
+
+bool profiler::writeHeatmap(const char *path) const
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    uint64_t hottest = 0;
+    for (int i = 0; i < 4096; ++i)
+    {
+        hottest = std::max(hottest, _addresses[i]);
+    }
+
+    // Counts span many orders of magnitude, so brightness follows the logarithm
+    const double scale = hottest != 0 ? 255.0 / log1p((double)hottest) : 0.0;
+    fputs("P5\n64 64\n255\n", file);
+    for (int i = 0; i < 4096; ++i)
+    {
+        fputc((int)(log1p((double)_addresses[i]) * scale + 0.5), file);
+    }
+
+    const bool written = ferror(file) == 0;
+    fclose(file);
+    return written;
+}
+
+uint64_t profiler::instructions() const
+{
+    return _instructions;
+}
+
+uint64_t profiler::executions(const unsigned short address) const
+{
+    return _addresses[address & 0x0FFF];
+}
+
+unsigned short profiler::opcode(const unsigned short address) const
+{
+    return _opcodes[address & 0x0FFF];
+}
+
+uint64_t profiler::sequences(const unsigned short address, const int length) const
+{
+    return length == 2 ? _pairs[address & 0x0FFF] : length == 3 ? _triples[address & 0x0FFF] : 0;
+}
@@ -0,0 +1,66 @@
+/// Execution profile of a Chip 8 program
+/// Counts how often each opcode family and each address is executed, how many sprites are drawn
+/// and how often each subroutine is called, to find the hot loops of a ROM and the interpreter
+/// paths that matter.
+///
+/// Only built into chip8 when compiled with -DCHIP8_PROFILE, so normal builds pay nothing.
+/// Profiling builds interpret every instruction, translated JIT blocks are never run.
+///
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+class profiler
+{
+public:
+    profiler();
+
+    void clear();
+
+    /// Count one instruction about to be executed at the given address
+    void instruction(const unsigned short address, const unsigned short opcode);
+
+    /// Add the counts of another profile, such as another machine in a batch
+    void merge(const profiler &other);
+
+    /// Write the opcode families, hot addresses and call targets, busiest first
+    void report(FILE *file, const unsigned int top = 20) const;
+
+    /// Write a 64x64 greyscale PGM image with one pixel per address, brighter for hotter addresses
+    bool writeHeatmap(const char *path) const;
+
+    uint64_t instructions() const;
+
+    /// Times the instruction at an address ran, and the opcode last seen there
+    uint64_t executions(const unsigned short address) const;
+    unsigned short opcode(const unsigned short address) const;
+
+    /// Times the instruction at an address ran straight on into the next one, or the next two with
+    /// length 3, without a jump or skip in between, which is what a superinstruction there would cover
+    uint64_t sequences(const unsigned short address, const int length) const;
+
+private:
+    /// Family of an opcode, the opcode with its operands masked out packed into 12 bits
+    static unsigned short family(const unsigned short opcode);
+
+    uint64_t _instructions;
+    uint64_t _families[4096];
+    uint64_t _addresses[4096];
+
+    /// Last opcode seen at each address, to label hot spots
+    unsigned short _opcodes[4096];
+
+    uint64_t _calls[4096];
+
+    /// Address of the last instruction and how many ran at consecutive addresses up to it
+    unsigned short _last;
+    unsigned int _straight;
+    uint64_t _pairs[4096];
+    uint64_t _triples[4096];
+    uint64_t _draws;
+    uint64_t _drawnRows;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/// Behaviour that differs between Chip 8 interpreters
+/// Programs are written for one interpreter and often depend on its quirks. Each preset is a
+/// policy type of compile time constants, and chip8 instantiates the handlers that care for every
+/// policy, so picking a preset costs nothing per instruction, see chip8::setQuirks().
+///
+/// The quirks covered:
+///     SHIFT_READS_VY          8XY6 and 8XYE shift VY into VX, rather than shifting VX in place
+///     LOAD_STORE_ADVANCES_I   FX55 and FX65 leave I just past the last register they touched
+///     JUMP_USES_VX            BNNN is BXNN, a jump to XNN plus VX rather than to NNN plus V0
+///     CLIP_SPRITES            sprites are cut off at the edges of the screen rather than wrapping
+///                             around, only their starting position wraps
+///
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <string.h>
+
+enum class quirks
+{
+    /// The original COSMAC VIP interpreter
+    VIP,
+    /// SUPER-CHIP 1.1 on the HP 48
+    SCHIP,
+    /// What most programs written since expect, and what chip8 did before presets existed
+    MODERN
+};
+
+struct vipQuirks
+{
+    static constexpr bool SHIFT_READS_VY = true;
+    static constexpr bool LOAD_STORE_ADVANCES_I = true;
+    static constexpr bool JUMP_USES_VX = false;
+    static constexpr bool CLIP_SPRITES = true;
+};
+
+struct schipQuirks
+{
+    static constexpr bool SHIFT_READS_VY = false;
+    static constexpr bool LOAD_STORE_ADVANCES_I = false;
+    static constexpr bool JUMP_USES_VX = true;
+    static constexpr bool CLIP_SPRITES = true;
+};
+
+struct modernQuirks
+{
+    static constexpr bool SHIFT_READS_VY = false;
+    static constexpr bool LOAD_STORE_ADVANCES_I = false;
+    static constexpr bool JUMP_USES_VX = false;
+    static constexpr bool CLIP_SPRITES = false;
+};
+
+/// Call f with a default constructed policy for a preset, the one place a preset turns into a type
+template <typename F>
+inline auto withQuirks(const quirks preset, F &&f)
+{
+    switch (preset)
+    {
+    case quirks::VIP:
+        return f(vipQuirks());
+    case quirks::SCHIP:
+        return f(schipQuirks());
+    default:
+        return f(modernQuirks());
+    }
+}
+
+/// Preset for a name given on a command line: vip, schip or modern
+inline bool parseQuirks(const char *name, quirks &preset)
+{
+    if (strcmp(name, "vip") == 0)
+    {
+        preset = quirks::VIP;
+    }
+    else if (strcmp(name, "schip") == 0)
+    {
+        preset = quirks::SCHIP;
+    }
+    else if (strcmp(name, "modern") == 0)
+    {
+        preset = quirks::MODERN;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+#endif
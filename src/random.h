@@ -0,0 +1,36 @@
+/// Small, fast and seedable random number generator (PCG32, XSH RR variant)
+/// The whole generator is one 64-bit word, so every machine can carry its own in its state
+/// and runs are reproducible from the seed alone.
+///
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+const uint64_t PCG_MULTIPLIER = 6364136223846793005ULL;
+const uint64_t PCG_INCREMENT = 1442695040888963407ULL;
+
+/// Seed used when nobody asks for a particular one
+const uint64_t DEFAULT_SEED = 0x853C49E6748FEA9BULL;
+
+/// Advance the generator and return the next 32 random bits
+inline uint32_t pcg32(uint64_t &state)
+{
+    const uint64_t old = state;
+    state = old * PCG_MULTIPLIER + PCG_INCREMENT;
+    const uint32_t shifted = ((old >> 18) ^ old) >> 27;
+    const uint32_t rotation = old >> 59;
+    return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+}
+
+/// Generator state for a seed
+inline uint64_t pcg32Seed(const uint64_t seed)
+{
+    uint64_t state = 0;
+    pcg32(state);
+    state += seed;
+    pcg32(state);
+    return state;
+}
+
+#endif
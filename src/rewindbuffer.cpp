@@ -0,0 +1,185 @@
+#include "rewindbuffer.h"
+#include <string.h>
+#include "delta.h"
+
+namespace
+{
+    /// Hand every field of a state but its memory to visit, as a pointer and a size, in the order they are flattened
+    /// The one list of fields flatten(), unflatten() and frameSize() are all built from, a field added to chip8::state only goes here.
+    template <typename STATE, typename VISIT>
+    void eachField(STATE &saved, VISIT visit)
+    {
+        visit(saved.v, sizeof(saved.v));
+        visit(&saved.indexRegister, sizeof(saved.indexRegister));
+        visit(&saved.programCounter, sizeof(saved.programCounter));
+        visit(saved.gfx, sizeof(saved.gfx));
+        visit(&saved.delayTimer, sizeof(saved.delayTimer));
+        visit(&saved.soundTimer, sizeof(saved.soundTimer));
+        visit(saved.stack, sizeof(saved.stack));
+        visit(&saved.stackPointer, sizeof(saved.stackPointer));
+        visit(&saved.keys, sizeof(saved.keys));
+        visit(&saved.waitingForKey, sizeof(saved.waitingForKey));
+        visit(&saved.halted, sizeof(saved.halted));
+        visit(&saved.random, sizeof(saved.random));
+        visit(&saved.instructions, sizeof(saved.instructions));
+        visit(&saved.frames, sizeof(saved.frames));
+        visit(&saved.frameStart, sizeof(saved.frameStart));
+        visit(&saved.frame, sizeof(saved.frame));
+    }
+
+    /// Bytes taken by a flattened chip8::state
+    /// A function rather than a constant, so rewind buffers constructed before main() can use it.
+    size_t frameSize()
+    {
+        static const size_t size = []
+        {
+            chip8::state saved;
+            size_t total = sizeof(chip8::memoryPage);
+            eachField(saved, [&](void *, const size_t fieldSize)
+                      { total += fieldSize; });
+            return total;
+        }();
+        return size;
+    }
+
+    /// Length stored before and after each delta in the ring
+    const size_t LENGTH_SIZE = sizeof(unsigned int);
+
+    /// Lay out a state as frameSize() bytes
+    void flatten(const chip8::state &saved, unsigned char *out)
+    {
+        memcpy(out, saved.memory->bytes, sizeof(chip8::memoryPage));
+        out += sizeof(chip8::memoryPage);
+        eachField(saved, [&](const void *field, const size_t size)
+                  {
+                      memcpy(out, field, size);
+                      out += size; });
+    }
+
+    void unflatten(const unsigned char *in, chip8::state &saved)
+    {
+        std::shared_ptr<chip8::memoryPage> memory(new chip8::memoryPage());
+        memcpy(memory->bytes, in, sizeof(chip8::memoryPage));
+        saved.memory = memory;
+        in += sizeof(chip8::memoryPage);
+        eachField(saved, [&](void *field, const size_t size)
+                  {
+                      memcpy(field, in, size);
+                      in += size; });
+    }
+}
+
+rewindBuffer::rewindBuffer(const size_t capacity)
+    : _ring(capacity), _current(frameSize()), _next(frameSize())
+{
+    clear();
+}
+
+void rewindBuffer::record(const chip8 &machine)
+{
+    flatten(machine.snapshot(), _next.data());
+
+    if (_haveCurrent)
+    {
+        _encoded.clear();
+        encodeDelta(_current.data(), _next.data(), frameSize(), _encoded);
+
+        const size_t needed = _encoded.size() + 2 * LENGTH_SIZE;
+        if (needed <= _ring.size())
+        {
+            while (_ring.size() - _used < needed)
+            {
+                dropOldest();
+            }
+
+            const unsigned int length = _encoded.size();
+            put((const unsigned char *)&length, LENGTH_SIZE);
+            put(_encoded.data(), _encoded.size());
+            put((const unsigned char *)&length, LENGTH_SIZE);
+            ++_frames;
+        }
+        else
+        {
+            // A delta bigger than the whole ring breaks the chain, history starts again here
+            _head = _tail = _used = _frames = 0;
+        }
+    }
+
+    _current.swap(_next);
+    _haveCurrent = true;
+}
+
+bool rewindBuffer::stepBack(chip8 &machine)
+{
+    if (_frames == 0)
+    {
+        return false;
+    }
+
+    // Walk back over the newest delta
+    unsigned int length;
+    get((_head + _ring.size() - LENGTH_SIZE) % _ring.size(), (unsigned char *)&length, LENGTH_SIZE);
+    const size_t start = (_head + _ring.size() - LENGTH_SIZE - length) % _ring.size();
+
+    _encoded.resize(length);
+    get(start, _encoded.data(), length);
+    if (!applyDelta(_encoded.data(), _encoded.data() + length, _current.data(), frameSize()))
+    {
+        // Only a bug could get here, history past a bad delta can't be trusted
+        clear();
+        return false;
+    }
+
+    _head = (start + _ring.size() - LENGTH_SIZE) % _ring.size();
+    _used -= length + 2 * LENGTH_SIZE;
+    --_frames;
+
+    chip8::state saved;
+    unflatten(_current.data(), saved);
+    machine.restore(saved);
+    return true;
+}
+
+size_t rewindBuffer::frames() const
+{
+    return _frames;
+}
+
+size_t rewindBuffer::bytesUsed() const
+{
+    return _used;
+}
+
+void rewindBuffer::clear()
+{
+    _head = 0;
+    _tail = 0;
+    _used = 0;
+    _frames = 0;
+    _haveCurrent = false;
+}
+
+void rewindBuffer::put(const unsigned char *data, const size_t size)
+{
+    const size_t first = size < _ring.size() - _head ? size : _ring.size() - _head;
+    memcpy(&_ring[_head], data, first);
+    memcpy(&_ring[0], data + first, size - first);
+    _head = (_head + size) % _ring.size();
+    _used += size;
+}
+
+void rewindBuffer::get(const size_t position, unsigned char *data, const size_t size) const
+{
+    const size_t first = size < _ring.size() - position ? size : _ring.size() - position;
+    memcpy(data, &_ring[position], first);
+    memcpy(data + first, &_ring[0], size - first);
+}
+
+void rewindBuffer::dropOldest()
+{
+    unsigned int length;
+    get(_tail, (unsigned char *)&length, LENGTH_SIZE);
+    _tail = (_tail + length + 2 * LENGTH_SIZE) % _ring.size();
+    _used -= length + 2 * LENGTH_SIZE;
+    --_frames;
+}
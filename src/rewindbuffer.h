@@ -0,0 +1,55 @@
+/// Rewind history for a chip8
+/// Record the machine once per frame and step back through the recorded frames one at a time.
+///
+/// Only the newest frame is kept whole. Every older frame is stored as the XOR of it and the
+/// frame after it, run-length encoded, so a frame where little changed costs a few bytes.
+/// Deltas live in a fixed size byte ring, and the oldest ones are dropped to make room.
+///
+#ifndef REWINDBUFFER_H
+#define REWINDBUFFER_H
+
+#include <stddef.h>
+#include <vector>
+#include "chip8.h"
+
+class rewindBuffer
+{
+public:
+    /// capacity is the number of bytes available for deltas
+    rewindBuffer(const size_t capacity = 256 * 1024);
+
+    /// Record the current state of the machine, call once per frame
+    void record(const chip8 &machine);
+
+    /// Put the machine back to the frame before the last one recorded or stepped back to
+    /// Returns false if there is no older frame left
+    bool stepBack(chip8 &machine);
+
+    /// Number of times stepBack() can succeed
+    size_t frames() const;
+
+    size_t bytesUsed() const;
+
+    void clear();
+
+private:
+    void put(const unsigned char *data, const size_t size);
+    void get(const size_t position, unsigned char *data, const size_t size) const;
+    void dropOldest();
+
+    /// Byte ring holding the deltas, oldest at _tail and newest just before _head
+    /// Each delta is stored as length, encoded bytes, length so it can be walked from either end
+    std::vector<unsigned char> _ring;
+    size_t _head;
+    size_t _tail;
+    size_t _used;
+    size_t _frames;
+
+    /// Flattened newest frame, and scratch space for the next one
+    std::vector<unsigned char> _current;
+    std::vector<unsigned char> _next;
+    std::vector<unsigned char> _encoded;
+    bool _haveCurrent;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/// ROM library indexer
+/// Builds or refreshes the index of a ROM directory tree and lists it, or looks ROMs up by hash.
+///
+/// Usage: romindex <rom directory> <index> [-j threads]
+///        romindex -f <index> <hash>
+///
+/// Listing and lookups print one ROM per line, tab separated: hash, size in bytes, path
+/// Identical ROMs share a hash, so duplicates in a library show up next to each other.
+///
+#include <filesystem>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "romlibrary.h"
+
+void print(const romLibrary::rom &entry)
+{
+    printf("%016" PRIx64 "\t%" PRIu64 "\t%s\n", entry.hash, entry.size, entry.path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fputs("Usage: romindex <rom directory> <index> [-j threads]\n       romindex -f <index> <hash>\n", stderr);
+        return 1;
+    }
+
+    romLibrary library;
+
+    if (strcmp(argv[1], "-f") == 0)
+    {
+        if (argc < 4 || !library.load(argv[2]))
+        {
+            return 1;
+        }
+
+        const romLibrary::rom *found = library.find(strtoull(argv[3], nullptr, 16));
+        if (found == nullptr)
+        {
+            return 1;
+        }
+
+        // Every copy of the ROM
+        for (const romLibrary::rom *entry = found; entry != library.roms().data() + library.roms().size() && entry->hash == found->hash; ++entry)
+        {
+            print(*entry);
+        }
+        return 0;
+    }
+
+    unsigned int threads = 0;
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            threads = atoi(argv[i + 1]);
+        }
+    }
+
+    // Start from the previous index, if there is one, so only new and changed files are read
+    if (std::filesystem::exists(argv[2]) && !library.load(argv[2]))
+    {
+        return 1;
+    }
+
+    const size_t hashed = library.scan(argv[1], threads);
+    if (!library.save(argv[2]))
+    {
+        return 1;
+    }
+
+    for (size_t i = 0; i < library.roms().size(); ++i)
+    {
+        print(library.roms()[i]);
+    }
+    fprintf(stderr, "%zu ROMs, %zu hashed\n", library.roms().size(), hashed);
+
+    return 0;
+}
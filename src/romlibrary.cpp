@@ -0,0 +1,265 @@
+#include "romlibrary.h"
+#include "hash.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char ROM_INDEX_MAGIC[4] = {'C', '8', 'R', 'I'};
+const unsigned char ROM_INDEX_VERSION = 1;
+
+namespace
+{
+    /// Hash the contents of a file, false if it can't be read
+    bool hashFile(const std::string &path, const uint64_t size, uint64_t &hash)
+    {
+#ifdef _WIN32
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        std::vector<unsigned char> contents(size);
+        const bool read = fread(contents.data(), 1, size, file) == size;
+        fclose(file);
+        hash = fnv1a(contents.data(), contents.size());
+        return read;
+#else
+        const int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            return false;
+        }
+        if (size == 0)
+        {
+            close(file);
+            hash = fnv1a(nullptr, 0);
+            return true;
+        }
+
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        hash = fnv1a(mapped, size);
+        munmap(mapped, size);
+        return true;
+#endif
+    }
+
+    void putVarint(FILE *file, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            fputc((value & 0x7F) | 0x80, file);
+            value >>= 7;
+        }
+        fputc(value, file);
+    }
+
+    bool getVarint(FILE *file, uint64_t &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const int byte = fgetc(file);
+            if (byte == EOF)
+            {
+                return false;
+            }
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void putWord(FILE *file, const uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            fputc((value >> (i * 8)) & 0xFF, file);
+        }
+    }
+
+    bool getWord(FILE *file, uint64_t &value)
+    {
+        value = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            const int byte = fgetc(file);
+            if (byte == EOF)
+            {
+                return false;
+            }
+            value |= (uint64_t)byte << (i * 8);
+        }
+        return true;
+    }
+
+    bool byHash(const romLibrary::rom &a, const romLibrary::rom &b)
+    {
+        return a.hash != b.hash ? a.hash < b.hash : a.path < b.path;
+    }
+}
+
+size_t romLibrary::scan(const char *directory, const unsigned int threads)
+{
+    std::unordered_map<std::string, const rom *> known;
+    for (size_t i = 0; i < _roms.size(); ++i)
+    {
+        known[_roms[i].path] = &_roms[i];
+    }
+
+    std::vector<rom> found;
+    std::vector<size_t> changed;
+    std::error_code error;
+    for (const std::filesystem::directory_entry &file : std::filesystem::recursive_directory_iterator(directory, error))
+    {
+        if (!file.is_regular_file())
+        {
+            continue;
+        }
+
+        rom entry;
+        entry.path = file.path().string();
+        entry.size = file.file_size();
+        entry.modified = file.last_write_time().time_since_epoch().count();
+        entry.hash = 0;
+
+        // Unchanged since the last scan, keep its hash
+        const std::unordered_map<std::string, const rom *>::const_iterator previous = known.find(entry.path);
+        if (previous != known.end() && previous->second->size == entry.size && previous->second->modified == entry.modified)
+        {
+            entry.hash = previous->second->hash;
+        }
+        else
+        {
+            changed.push_back(found.size());
+        }
+        found.push_back(entry);
+    }
+
+    // Each job owns one entry, so there is nothing to lock
+    std::vector<unsigned char> readable(found.size(), 1);
+    {
+        threadPool pool(threads);
+        for (size_t i = 0; i < changed.size(); ++i)
+        {
+            rom *entry = &found[changed[i]];
+            unsigned char *ok = &readable[changed[i]];
+            pool.submit([entry, ok]
+                        { *ok = hashFile(entry->path, entry->size, entry->hash); });
+        }
+        pool.wait();
+    }
+
+    _roms.clear();
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        if (readable[i])
+        {
+            _roms.push_back(found[i]);
+        }
+    }
+    std::sort(_roms.begin(), _roms.end(), byHash);
+
+    return changed.size();
+}
+
+bool romLibrary::save(const char *path) const
+{
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    fwrite(ROM_INDEX_MAGIC, 1, sizeof(ROM_INDEX_MAGIC), file);
+    fputc(ROM_INDEX_VERSION, file);
+    for (size_t i = 0; i < _roms.size(); ++i)
+    {
+        putWord(file, _roms[i].hash);
+        putWord(file, _roms[i].modified);
+        putVarint(file, _roms[i].size);
+        putVarint(file, _roms[i].path.size());
+        fwrite(_roms[i].path.data(), 1, _roms[i].path.size(), file);
+    }
+
+    const bool written = ferror(file) == 0;
+    fclose(file);
+    return written;
+}
+
+bool romLibrary::load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    char magic[sizeof(ROM_INDEX_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, ROM_INDEX_MAGIC, sizeof(magic)) != 0 || fgetc(file) != ROM_INDEX_VERSION)
+    {
+        fprintf(stderr, "%s is not a ROM index\n", path);
+        fclose(file);
+        return false;
+    }
+
+    std::vector<rom> roms;
+    uint64_t hash;
+    while (getWord(file, hash))
+    {
+        rom entry;
+        entry.hash = hash;
+        uint64_t modified;
+        uint64_t length;
+        if (!getWord(file, modified) || !getVarint(file, entry.size) || !getVarint(file, length))
+        {
+            fprintf(stderr, "%s is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+        entry.modified = modified;
+        entry.path.resize(length);
+        if (fread(&entry.path[0], 1, length, file) != length)
+        {
+            fprintf(stderr, "%s is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+        roms.push_back(entry);
+    }
+
+    fclose(file);
+    _roms.swap(roms);
+    std::sort(_roms.begin(), _roms.end(), byHash);
+    return true;
+}
+
+const romLibrary::rom *romLibrary::find(const uint64_t hash) const
+{
+    const std::vector<rom>::const_iterator found = std::lower_bound(_roms.begin(), _roms.end(), hash, [](const rom &entry, const uint64_t value)
+                                                                    { return entry.hash < value; });
+    return found != _roms.end() && found->hash == hash ? &*found : nullptr;
+}
+
+const std::vector<romLibrary::rom> &romLibrary::roms() const
+{
+    return _roms;
+}
@@ -0,0 +1,47 @@
+/// Index of the ROM files in a directory tree, by content hash
+/// Scanning hashes every file on all cores. An index saved by an earlier scan lets the next one
+/// skip every file whose size and modification time haven't changed, so large libraries are
+/// only read once.
+///
+/// Index file format, all numbers little endian:
+/// "C8RI", version byte, then one entry per ROM, in hash order:
+/// 8 byte hash, 8 byte modification time, size and path length as base 128 varints, path bytes
+///
+#ifndef ROMLIBRARY_H
+#define ROMLIBRARY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class romLibrary
+{
+public:
+    struct rom
+    {
+        std::string path;
+        uint64_t size;
+        int64_t modified;
+
+        /// fnv1a() of the contents, the same for identical ROMs wherever they are
+        uint64_t hash;
+    };
+
+    /// Index every file under the directory, hashing new and changed files in parallel
+    /// Returns the number of files hashed, files that can't be read are left out.
+    size_t scan(const char *directory, const unsigned int threads = 0);
+
+    bool save(const char *path) const;
+    bool load(const char *path);
+
+    /// A ROM with the given contents hash, or nullptr
+    const rom *find(const uint64_t hash) const;
+
+    /// Every ROM, in hash order
+    const std::vector<rom> &roms() const;
+
+private:
+    std::vector<rom> _roms;
+};
+
+#endif
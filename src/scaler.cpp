@@ -0,0 +1,262 @@
+#include "scaler.h"
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+#if defined(__AVX2__)
+    /// Number of 32-bit pixels one vector holds
+    const unsigned int PIXEL_LANES = 8;
+
+    typedef __m256i vec;
+
+    inline vec pixels(const uint32_t colour)
+    {
+        return _mm256_set1_epi32((int)colour);
+    }
+
+    inline void storePixels(uint32_t *out, const vec value)
+    {
+        _mm256_storeu_si256((__m256i *)out, value);
+    }
+
+    /// All ones for the lit pixels among the PIXEL_LANES starting at x
+    inline vec litPixels(const uint64_t row, const unsigned int x)
+    {
+        const vec bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+        const vec group = _mm256_set1_epi32((int)((row >> (56 - x)) & 0xFF));
+        return _mm256_cmpeq_epi32(_mm256_and_si256(group, bits), bits);
+    }
+
+    /// mask ? a : b for every pixel
+    inline vec select(const vec mask, const vec a, const vec b)
+    {
+        return _mm256_blendv_epi8(b, a, mask);
+    }
+#elif defined(__SSE2__)
+    const unsigned int PIXEL_LANES = 4;
+
+    typedef __m128i vec;
+
+    inline vec pixels(const uint32_t colour)
+    {
+        return _mm_set1_epi32((int)colour);
+    }
+
+    inline void storePixels(uint32_t *out, const vec value)
+    {
+        _mm_storeu_si128((__m128i *)out, value);
+    }
+
+    inline vec litPixels(const uint64_t row, const unsigned int x)
+    {
+        const vec bits = _mm_setr_epi32(0x8, 0x4, 0x2, 0x1);
+        const vec group = _mm_set1_epi32((int)((row >> (60 - x)) & 0xF));
+        return _mm_cmpeq_epi32(_mm_and_si128(group, bits), bits);
+    }
+
+    inline vec select(const vec mask, const vec a, const vec b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+#else
+    /// Without SIMD every "vector" is a single pixel, the same code then runs as a plain loop
+    const unsigned int PIXEL_LANES = 1;
+
+    typedef uint32_t vec;
+
+    inline vec pixels(const uint32_t colour)
+    {
+        return colour;
+    }
+
+    inline void storePixels(uint32_t *out, const vec value)
+    {
+        *out = value;
+    }
+
+    inline vec litPixels(const uint64_t row, const unsigned int x)
+    {
+        return (row >> (63 - x)) & 1 ? 0xFFFFFFFF : 0;
+    }
+
+    inline vec select(const vec mask, const vec a, const vec b)
+    {
+        return (a & mask) | (b & ~mask);
+    }
+#endif
+
+    /// 0xRRGGBB as R, G, B, A bytes in memory
+    inline uint32_t rgba(const uint32_t colour)
+    {
+        const unsigned char red = colour >> 16;
+        const unsigned char green = colour >> 8;
+        const unsigned char blue = colour;
+        return 0xFF000000u | (uint32_t)blue << 16 | (uint32_t)green << 8 | red;
+    }
+
+    /// Blend two RGBA colours, weight 0 gives a and 255 gives b
+    inline uint32_t blend(const uint32_t a, const uint32_t b, const unsigned int weight)
+    {
+        uint32_t result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            const unsigned int from = (a >> shift) & 0xFF;
+            const unsigned int to = (b >> shift) & 0xFF;
+            result |= ((from * (255 - weight) + to * weight + 127) / 255) << shift;
+        }
+        return result;
+    }
+
+    /// Scale the brightness of an RGBA colour, leaving alpha alone
+    inline uint32_t darken(const uint32_t colour, const unsigned int brightness)
+    {
+        return (blend(0xFF000000u, colour, brightness) & 0x00FFFFFF) | (colour & 0xFF000000u);
+    }
+
+    /// Write count copies of a colour
+    inline void fill(uint32_t *out, const uint32_t colour, const unsigned int count)
+    {
+        const vec wide = pixels(colour);
+        unsigned int i = 0;
+        for (; i + PIXEL_LANES <= count; i += PIXEL_LANES)
+        {
+            storePixels(out + i, wide);
+        }
+        for (; i < count; ++i)
+        {
+            out[i] = colour;
+        }
+    }
+}
+
+scaler::scaler(const unsigned int scale)
+    : _scale(scale > 0 ? scale : 1), _off(rgba(0x000000)), _on(rgba(0xFFFFFF)), _scanlines(255), _persistence(0), _fading(false)
+{
+    memset(_brightness, 0, sizeof(_brightness));
+    updateRamps();
+}
+
+void scaler::setPalette(const uint32_t off, const uint32_t on)
+{
+    _off = rgba(off);
+    _on = rgba(on);
+    updateRamps();
+}
+
+void scaler::setScanlines(const unsigned char brightness)
+{
+    _scanlines = brightness;
+    updateRamps();
+}
+
+void scaler::setGhosting(const unsigned char persistence)
+{
+    // Brightness isn't tracked without ghosting, start from a dark screen
+    if (_persistence == 0)
+    {
+        memset(_brightness, 0, sizeof(_brightness));
+    }
+    _persistence = persistence;
+}
+
+void scaler::updateRamps()
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        _ramp[i] = blend(_off, _on, i);
+        _scanlineRamp[i] = darken(_ramp[i], _scanlines);
+    }
+}
+
+void scaler::render(const uint64_t *gfx, uint32_t *out, const size_t pitch)
+{
+    const unsigned int width = 64 * _scale;
+
+    // One Chip 8 row as full size lines, filled once and copied down the rest of its block
+    uint32_t colours[64];
+    uint32_t scanlineColours[64];
+
+    // Scanlines only make sense when a block is more than one line tall
+    const bool scanlines = _scanlines != 255 && _scale > 1;
+    _fading = false;
+
+    for (int y = 0; y < 32; ++y)
+    {
+        const uint64_t row = gfx[y];
+
+        if (_persistence == 0)
+        {
+            // Two colours only, picked straight from the bits
+            const vec on = pixels(_ramp[255]);
+            const vec off = pixels(_ramp[0]);
+            const vec scanlineOn = pixels(_scanlineRamp[255]);
+            const vec scanlineOff = pixels(_scanlineRamp[0]);
+            for (unsigned int x = 0; x < 64; x += PIXEL_LANES)
+            {
+                const vec lit = litPixels(row, x);
+                storePixels(colours + x, select(lit, on, off));
+                storePixels(scanlineColours + x, select(lit, scanlineOn, scanlineOff));
+            }
+        }
+        else
+        {
+            // Lit pixels are at full brightness, the rest lose some of what they had
+            unsigned char *brightness = _brightness + y * 64;
+            for (int x = 0; x < 64; ++x)
+            {
+                const unsigned char level = (row >> (63 - x)) & 1 ? 255 : (brightness[x] * _persistence) >> 8;
+                brightness[x] = level;
+                _fading |= level != 0 && level != 255;
+                colours[x] = _ramp[level];
+                scanlineColours[x] = _scanlineRamp[level];
+            }
+        }
+
+        uint32_t *line = out + (size_t)y * _scale * pitch;
+        for (int x = 0; x < 64; ++x)
+        {
+            fill(line + x * _scale, colours[x], _scale);
+        }
+
+        const unsigned int plainLines = scanlines ? _scale - 1 : _scale;
+        for (unsigned int i = 1; i < plainLines; ++i)
+        {
+            memcpy(line + i * pitch, line, width * sizeof(uint32_t));
+        }
+
+        if (scanlines)
+        {
+            uint32_t *scanline = line + (_scale - 1) * pitch;
+            for (int x = 0; x < 64; ++x)
+            {
+                fill(scanline + x * _scale, scanlineColours[x], _scale);
+            }
+        }
+    }
+}
+
+bool scaler::fading() const
+{
+    return _fading;
+}
+
+unsigned int scaler::scale() const
+{
+    return _scale;
+}
+
+unsigned int scaler::width() const
+{
+    return 64 * _scale;
+}
+
+unsigned int scaler::height() const
+{
+    return 32 * _scale;
+}
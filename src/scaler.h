@@ -0,0 +1,60 @@
+/// Software upscaler from the 64x32 Chip 8 screen to an RGBA image
+/// Every Chip 8 pixel becomes a scale x scale block in one of two palette colours.
+/// Optional effects:
+///     scanlines   the bottom line of every block is drawn darker
+///     ghosting    pixels that go out fade away over a few frames, like a slow phosphor
+///
+/// Uses AVX2 or SSE2 when compiled with -mavx2 or for x86-64, plain loops otherwise.
+/// render() writes into a buffer owned by the caller and never allocates.
+///
+/// Colours are given as 0xRRGGBB and written as R, G, B, A bytes, which is GL_RGBA with
+/// GL_UNSIGNED_BYTE on little endian hosts.
+///
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class scaler
+{
+public:
+    scaler(const unsigned int scale);
+
+    void setPalette(const uint32_t off, const uint32_t on);
+
+    /// Brightness of the scanlines from 0 (black) to 255 (no scanlines)
+    void setScanlines(const unsigned char brightness);
+
+    /// Share of its brightness a pixel keeps each frame after going out, from 0 (no ghosting) to 255
+    void setGhosting(const unsigned char persistence);
+
+    /// Draw a screen laid out like chip8::gfx() into pixels, which holds height() rows of pitch pixels
+    void render(const uint64_t *gfx, uint32_t *pixels, const size_t pitch);
+
+    /// True while some pixel is still fading, the whole image changes from frame to frame until it isn't
+    bool fading() const;
+
+    unsigned int scale() const;
+    unsigned int width() const;
+    unsigned int height() const;
+
+private:
+    void updateRamps();
+
+    unsigned int _scale;
+    uint32_t _off;
+    uint32_t _on;
+    unsigned char _scanlines;
+    unsigned char _persistence;
+
+    /// Colour for every brightness from off to on, for ordinary lines and for scanlines
+    uint32_t _ramp[256];
+    uint32_t _scanlineRamp[256];
+
+    /// Brightness of every Chip 8 pixel as of the last render, used for ghosting
+    unsigned char _brightness[64 * 32];
+    bool _fading;
+};
+
+#endif
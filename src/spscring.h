@@ -0,0 +1,70 @@
+/// Lock-free ring buffer for passing values from one producer thread to one consumer thread
+/// push() and pop() never block and never allocate, so they are safe to call from input or audio
+/// callbacks. The capacity is a power of two, one slot is always left empty.
+///
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <stddef.h>
+
+template <typename T, size_t CAPACITY>
+class spscRing
+{
+    static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+public:
+    spscRing()
+        : _head(0), _tail(0)
+    {
+    }
+
+    /// Add a value, returns false if the ring is full. Producer only.
+    bool push(const T &value)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        const size_t next = (head + 1) & (CAPACITY - 1);
+        if (next == _tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        _slots[head] = value;
+        _head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /// Take the oldest value, returns false if the ring is empty. Consumer only.
+    bool pop(T &value)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = _slots[tail];
+        _tail.store((tail + 1) & (CAPACITY - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+    }
+
+    /// Values waiting to be popped, exact only on the consumer side
+    size_t size() const
+    {
+        return (_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire)) & (CAPACITY - 1);
+    }
+
+private:
+    T _slots[CAPACITY];
+
+    /// Next slot to write, only stored by the producer
+    alignas(64) std::atomic<size_t> _head;
+
+    /// Next slot to read, only stored by the consumer
+    alignas(64) std::atomic<size_t> _tail;
+};
+
+#endif
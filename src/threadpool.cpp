@@ -0,0 +1,145 @@
+#include "threadpool.h"
+
+threadPool::threadPool(unsigned int threads)
+    : _queued(0), _pending(0), _next(0), _stopping(false)
+{
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+    }
+
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        _workers.push_back(std::unique_ptr<worker>(new worker()));
+    }
+
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        _threads.push_back(std::thread(&threadPool::work, this, i));
+    }
+}
+
+threadPool::~threadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopping = true;
+    }
+    _wake.notify_all();
+
+    for (size_t i = 0; i < _threads.size(); ++i)
+    {
+        _threads[i].join();
+    }
+}
+
+void threadPool::submit(std::function<void()> job)
+{
+    // Counted before the job is visible, a worker that takes it at once must never see the counts wrap
+    unsigned int index;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        index = _next;
+        _next = (_next + 1) % _workers.size();
+        ++_queued;
+        ++_pending;
+    }
+
+    try
+    {
+        std::lock_guard<std::mutex> guard(_workers[index]->lock);
+        _workers[index]->jobs.push_back(std::move(job));
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        --_queued;
+        --_pending;
+        throw;
+    }
+    _wake.notify_one();
+}
+
+void threadPool::wait()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    _done.wait(guard, [this]
+               { return _pending == 0; });
+}
+
+unsigned int threadPool::size() const
+{
+    return _workers.size();
+}
+
+/// Pop our own newest job, or steal the oldest job of another worker
+bool threadPool::take(const unsigned int index, std::function<void()> &job)
+{
+    {
+        worker &own = *_workers[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty())
+        {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < _workers.size(); ++i)
+    {
+        worker &victim = *_workers[(index + i) % _workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void threadPool::work(const unsigned int index)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _wake.wait(guard, [this]
+                       { return _queued > 0 || _stopping; });
+            if (_queued == 0 && _stopping)
+            {
+                return;
+            }
+        }
+
+        std::function<void()> job;
+        if (!take(index, job))
+        {
+            // Another worker got there first
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            --_queued;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            --_pending;
+            if (_pending == 0)
+            {
+                _done.notify_all();
+            }
+        }
+    }
+}
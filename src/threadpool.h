@@ -0,0 +1,61 @@
+/// Work-stealing thread pool
+/// Every worker owns a queue of jobs. Workers run their own jobs newest first and, when they
+/// run dry, steal the oldest job from another worker, so long and short jobs balance out
+/// without a single contended queue.
+///
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class threadPool
+{
+public:
+    /// Start the given number of workers, or one per hardware thread if zero
+    threadPool(unsigned int threads = 0);
+    ~threadPool();
+
+    void submit(std::function<void()> job);
+
+    /// Block until every submitted job has finished
+    void wait();
+
+    unsigned int size() const;
+
+private:
+    struct worker
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> jobs;
+    };
+
+    void work(const unsigned int index);
+    bool take(const unsigned int index, std::function<void()> &job);
+
+    std::vector<std::unique_ptr<worker>> _workers;
+    std::vector<std::thread> _threads;
+
+    /// Guards the counters below, idle workers sleep on _wake and wait() sleeps on _done
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+
+    /// Jobs sitting in some worker queue
+    size_t _queued;
+
+    /// Jobs submitted but not yet finished
+    size_t _pending;
+
+    /// Worker queue the next submitted job goes to
+    unsigned int _next;
+
+    bool _stopping;
+};
+
+#endif
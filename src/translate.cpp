@@ -0,0 +1,481 @@
+/// Ahead of time ROM translator
+/// Walks the code of a ROM that can be reached from 0x200 and writes it out as C++, one function
+/// per basic block, for ROMs run often enough to be worth a build step. See aot.h for how the
+/// result is linked in and used.
+///
+/// Usage: translate <rom> <output.cpp> [-n name]
+///
+/// The walk follows jumps, calls, returns and both ways out of every skip. BNNN jumps to an
+/// address only known while running, so the walk stops there and FX0A is left to the interpreter
+/// as it blocks, everything else becomes part of a block. Blocks start at 0x200, at every jump or
+/// call target and after every skip or call, so any address the program can get to is the start
+/// of one.
+///
+/// Prints how many blocks were written and how many of the reachable instructions they cover.
+///
+#include <filesystem>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "hash.h"
+
+const unsigned int PROGRAM_START = 0x200;
+const unsigned int MEMORY_SIZE = 4096;
+
+/// How a block deals with an instruction
+enum treatment
+{
+    /// Written out in C++
+    SPELLED_OUT,
+    /// Handed to the interpreter's handler from inside the block
+    INTERPRETED,
+    /// Ends the block before it, the interpreter runs it on its own
+    LEFT_OUT
+};
+
+/// Registers and pointers a block's code uses, only those get declared
+enum uses
+{
+    USES_V = 1,
+    USES_I = 2,
+    USES_PC = 4,
+    USES_STACK = 8
+};
+
+/// What to do with an opcode, mirroring what chip8::decode() makes of it
+/// ends is set for instructions that decide where the program goes next, which end their block.
+treatment classify(const unsigned short opcode, bool &ends)
+{
+    const unsigned int low = opcode & 0x000F;
+    const unsigned int nn = opcode & 0x00FF;
+    ends = false;
+
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        // Decoding only looks at the low nibble, which is how 0x0NN0 ends up as 00E0
+        if (low == 0x0)
+        {
+            return INTERPRETED;
+        }
+        ends = true;
+        return low == 0xE ? SPELLED_OUT : LEFT_OUT;
+    case 0x1:
+    case 0x2:
+    case 0x3:
+    case 0x4:
+    case 0x5:
+    case 0x9:
+        ends = true;
+        return SPELLED_OUT;
+    case 0x8:
+        // Shifts depend on the quirks, the interpreter's handler already knows which ones apply
+        if (low == 0x6 || low == 0xE)
+        {
+            return INTERPRETED;
+        }
+        return low <= 0x7 ? SPELLED_OUT : LEFT_OUT;
+    case 0xB:
+        return LEFT_OUT;
+    case 0xC:
+    case 0xD:
+        return INTERPRETED;
+    case 0xE:
+        ends = true;
+        return nn == 0x9E || nn == 0xA1 ? INTERPRETED : LEFT_OUT;
+    case 0xF:
+        switch (nn)
+        {
+        case 0x1E:
+            return SPELLED_OUT;
+        case 0x33:
+        case 0x55:
+            // Writes memory, which may be code this very block was translated from
+            ends = true;
+            return INTERPRETED;
+        case 0x07:
+        case 0x15:
+        case 0x18:
+        case 0x29:
+        case 0x65:
+            return INTERPRETED;
+        default:
+            return LEFT_OUT;
+        }
+    default:
+        return SPELLED_OUT;
+    }
+}
+
+/// Mark every instruction reachable from 0x200, and the addresses blocks have to start at
+void walk(const std::vector<unsigned char> &memory, const unsigned int end, std::vector<bool> &reached, std::vector<bool> &leader)
+{
+    std::vector<unsigned int> pending;
+    auto branch = [&](const unsigned int target)
+    {
+        if (target < MEMORY_SIZE)
+        {
+            leader[target] = true;
+            pending.push_back(target);
+        }
+    };
+
+    branch(PROGRAM_START);
+    while (!pending.empty())
+    {
+        const unsigned int address = pending.back();
+        pending.pop_back();
+
+        // Code outside the ROM, or at an odd address, is left to the interpreter
+        if (address < PROGRAM_START || address + 1 >= end || (address & 1) != 0 || reached[address])
+        {
+            continue;
+        }
+        reached[address] = true;
+
+        const unsigned short opcode = memory[address] << 8 | memory[address + 1];
+        bool ends;
+        const treatment how = classify(opcode, ends);
+        switch (opcode >> 12)
+        {
+        case 0x0:
+            // 00EE returns wherever the call came from, which the call already marked
+            if (how == INTERPRETED)
+            {
+                pending.push_back(address + 2);
+            }
+            break;
+        case 0x1:
+            branch(opcode & 0x0FFF);
+            break;
+        case 0x2:
+            branch(opcode & 0x0FFF);
+            branch(address + 2);
+            break;
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xE:
+            if (how != LEFT_OUT)
+            {
+                branch(address + 2);
+                branch(address + 4);
+            }
+            break;
+        case 0xB:
+            break;
+        default:
+            // FX0A carries on once a key is pressed, anything else left out is a bad opcode that goes nowhere
+            if (how == LEFT_OUT && (opcode & 0xF0FF) != 0xF00A)
+            {
+                break;
+            }
+            if (how == LEFT_OUT || ends)
+            {
+                branch(address + 2);
+            }
+            else
+            {
+                pending.push_back(address + 2);
+            }
+        }
+    }
+}
+
+/// C++ for one instruction of a block
+void spellOut(const unsigned int address, const unsigned short opcode, std::string &code, unsigned int &used)
+{
+    const unsigned int x = (opcode & 0x0F00) >> 8;
+    const unsigned int y = (opcode & 0x00F0) >> 4;
+    const unsigned int nn = opcode & 0x00FF;
+    const unsigned int nnn = opcode & 0x0FFF;
+
+    char line[160];
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        snprintf(line, sizeof(line), "--sp;\n        pc = stack[sp & 0xF] + 2;");
+        used |= USES_PC | USES_STACK;
+        break;
+    case 0x1:
+        snprintf(line, sizeof(line), "pc = 0x%03X;", nnn);
+        used |= USES_PC;
+        break;
+    case 0x2:
+        snprintf(line, sizeof(line), "stack[sp & 0xF] = 0x%03X;\n        ++sp;\n        pc = 0x%03X;", address, nnn);
+        used |= USES_PC | USES_STACK;
+        break;
+    case 0x3:
+    case 0x4:
+        snprintf(line, sizeof(line), "pc = v[0x%X] %s 0x%02X ? 0x%03X : 0x%03X;", x, opcode >> 12 == 0x3 ? "==" : "!=", nn, address + 4, address + 2);
+        used |= USES_V | USES_PC;
+        break;
+    case 0x5:
+    case 0x9:
+        snprintf(line, sizeof(line), "pc = v[0x%X] %s v[0x%X] ? 0x%03X : 0x%03X;", x, opcode >> 12 == 0x5 ? "==" : "!=", y, address + 4, address + 2);
+        used |= USES_V | USES_PC;
+        break;
+    case 0x6:
+        snprintf(line, sizeof(line), "v[0x%X] = 0x%02X;", x, nn);
+        used |= USES_V;
+        break;
+    case 0x7:
+        snprintf(line, sizeof(line), "v[0x%X] += 0x%02X;", x, nn);
+        used |= USES_V;
+        break;
+    case 0x8:
+        // Flags are written before the result, in the same order as the interpreter, for when X or Y is F
+        switch (opcode & 0x000F)
+        {
+        case 0x0:
+            snprintf(line, sizeof(line), "v[0x%X] = v[0x%X];", x, y);
+            break;
+        case 0x1:
+            snprintf(line, sizeof(line), "v[0x%X] |= v[0x%X];", x, y);
+            break;
+        case 0x2:
+            snprintf(line, sizeof(line), "v[0x%X] &= v[0x%X];", x, y);
+            break;
+        case 0x3:
+            snprintf(line, sizeof(line), "v[0x%X] ^= v[0x%X];", x, y);
+            break;
+        // A register compared with itself gives a constant flag, which is written out as one
+        case 0x4:
+            if (x == y)
+            {
+                snprintf(line, sizeof(line), "v[0xF] = 0;\n        v[0x%X] += v[0x%X];", x, y);
+                break;
+            }
+            snprintf(line, sizeof(line), "v[0xF] = v[0x%X] > v[0x%X];\n        v[0x%X] += v[0x%X];", y, x, x, y);
+            break;
+        case 0x5:
+            if (x == y)
+            {
+                snprintf(line, sizeof(line), "v[0xF] = 1;\n        v[0x%X] -= v[0x%X];", x, y);
+                break;
+            }
+            snprintf(line, sizeof(line), "v[0xF] = v[0x%X] <= v[0x%X];\n        v[0x%X] -= v[0x%X];", y, x, x, y);
+            break;
+        default:
+            if (x == y)
+            {
+                snprintf(line, sizeof(line), "v[0xF] = 1;\n        v[0x%X] = v[0x%X] - v[0x%X];", x, y, x);
+                break;
+            }
+            snprintf(line, sizeof(line), "v[0xF] = v[0x%X] <= v[0x%X];\n        v[0x%X] = v[0x%X] - v[0x%X];", x, y, x, y, x);
+        }
+        used |= USES_V;
+        break;
+    case 0xA:
+        snprintf(line, sizeof(line), "i = 0x%03X;", nnn);
+        used |= USES_I;
+        break;
+    default:
+        snprintf(line, sizeof(line), "v[0xF] = i + v[0x%X] > 0xFFF;\n        i += v[0x%X];", x, x);
+        used |= USES_V | USES_I;
+    }
+
+    code += "        ";
+    code += line;
+    snprintf(line, sizeof(line), " // %03X: %04X\n", address, opcode);
+    code += line;
+}
+
+/// text as the inside of a C++ string literal
+/// Quotes and backslashes are escaped and other bytes outside printable ASCII written in octal,
+/// which unlike \x never runs on into the characters after it.
+std::string stringLiteral(const std::string &text)
+{
+    std::string escaped;
+    for (const unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (c < 0x20 || c > 0x7E)
+        {
+            char octal[8];
+            snprintf(octal, sizeof(octal), "\\%03o", c);
+            escaped += octal;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/// text safe to put in a // comment, anything outside printable ASCII becomes ?
+/// A trailing backslash would splice the next line into the comment, so that goes too.
+std::string commentText(const std::string &text)
+{
+    std::string safe;
+    for (const unsigned char c : text)
+    {
+        safe += c < 0x20 || c > 0x7E || c == '\\' ? '?' : (char)c;
+    }
+    return safe;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fputs("Usage: translate <rom> <output.cpp> [-n name]\n", stderr);
+        return 1;
+    }
+
+    std::string name = std::filesystem::path(argv[1]).filename().string();
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-n") == 0)
+        {
+            name = argv[i + 1];
+        }
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<unsigned char> memory(MEMORY_SIZE);
+    const size_t size = fread(&memory[PROGRAM_START], 1, MEMORY_SIZE - PROGRAM_START, file);
+    const bool tooBig = fgetc(file) != EOF;
+    fclose(file);
+    if (tooBig)
+    {
+        fprintf(stderr, "Program %s is too big\n", argv[1]);
+        return 1;
+    }
+
+    const unsigned int end = PROGRAM_START + size;
+    std::vector<bool> reached(MEMORY_SIZE);
+    std::vector<bool> leader(MEMORY_SIZE);
+    walk(memory, end, reached, leader);
+
+    std::string blocks;
+    std::string table;
+    unsigned int count = 0;
+    unsigned int translated = 0;
+    unsigned int reachable = 0;
+    for (unsigned int address = PROGRAM_START; address + 1 < end; address += 2)
+    {
+        reachable += reached[address] ? 1 : 0;
+        if (!leader[address] || !reached[address])
+        {
+            continue;
+        }
+
+        // Up to the first instruction that decides where to go next, or the start of another block
+        std::string code;
+        unsigned int used = 0;
+        unsigned int length = 0;
+        bool ended = false;
+        unsigned int next = address;
+        while (next + 1 < end && !ended && (next == address || !leader[next]))
+        {
+            const unsigned short opcode = memory[next] << 8 | memory[next + 1];
+            const treatment how = classify(opcode, ended);
+            if (how == LEFT_OUT)
+            {
+                ended = false;
+                break;
+            }
+
+            if (how == INTERPRETED)
+            {
+                char line[80];
+                snprintf(line, sizeof(line), "        aot::interpret(machine, 0x%03X); // %04X\n", next, opcode);
+                code += line;
+            }
+            else
+            {
+                spellOut(next, opcode, code, used);
+            }
+            ++length;
+            next += 2;
+        }
+
+        if (length == 0)
+        {
+            continue;
+        }
+        if (!ended)
+        {
+            char line[64];
+            snprintf(line, sizeof(line), "        pc = 0x%03X;\n", next);
+            code += line;
+            used |= USES_PC;
+        }
+
+        char line[160];
+        snprintf(line, sizeof(line), "\n    // 0x%03X - 0x%03X\n    void block%03X(chip8 &machine)\n    {\n", address, next - 1, address);
+        blocks += line;
+        if (used & USES_V)
+        {
+            blocks += "        unsigned char *v = aot::v(machine);\n";
+        }
+        if (used & USES_I)
+        {
+            blocks += "        unsigned short &i = aot::indexRegister(machine);\n";
+        }
+        if (used & USES_PC)
+        {
+            blocks += "        unsigned short &pc = aot::programCounter(machine);\n";
+        }
+        if (used & USES_STACK)
+        {
+            blocks += "        unsigned short *stack = aot::stack(machine);\n        unsigned short &sp = aot::stackPointer(machine);\n";
+        }
+        blocks += code;
+        blocks += "    }\n";
+
+        snprintf(line, sizeof(line), "        {0x%03X, %u, %u, block%03X},\n", address, next - address, length, address);
+        table += line;
+        ++count;
+        translated += length;
+    }
+
+    if (count == 0)
+    {
+        fprintf(stderr, "Nothing in %s can be translated\n", argv[1]);
+        return 1;
+    }
+
+    FILE *output = fopen(argv[2], "w");
+    if (output == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(output, "/// %s translated ahead of time, written by translate, edit the ROM rather than this\n", commentText(name).c_str());
+    fprintf(output, "/// %u blocks covering %u of the %u instructions reachable from 0x200, see aot.h\n", count, translated, reachable);
+    fputs("///\n#include \"aot.h\"\n\nnamespace\n{", output);
+    fputs(blocks.c_str(), output);
+    fputs("\n    const aot::block BLOCKS[] = {\n", output);
+    fputs(table.c_str(), output);
+    fputs("    };\n\n", output);
+    fputs("    /// Makes the blocks known before main() runs\n", output);
+    fputs("    struct registration\n    {\n        registration()\n        {\n", output);
+    fprintf(output, "            const aot::program translated = {\"%s\", 0x%016" PRIx64 "ULL, %zu, BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0])};\n",
+            stringLiteral(name).c_str(), fnv1a(&memory[PROGRAM_START], size), size);
+    fputs("            aot::add(translated);\n        }\n    } REGISTRATION;\n}\n", output);
+
+    if (fclose(output) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(stderr, "%u blocks, %u of %u reachable instructions\n", count, translated, reachable);
+    return 0;
+}
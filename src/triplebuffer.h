@@ -0,0 +1,65 @@
+/// Lock-free triple buffer for handing values from one producer thread to one consumer thread
+/// The producer fills the back slot and publishes it, the consumer picks up the newest published
+/// slot. Neither side ever waits for the other: a producer running ahead overwrites values that
+/// were never picked up, and a consumer with nothing new keeps the value it has.
+///
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+template <typename T>
+class tripleBuffer
+{
+public:
+    tripleBuffer()
+        : _back(0), _middle(1), _front(2)
+    {
+    }
+
+    /// Slot the producer fills before calling publish()
+    T &back()
+    {
+        return _slots[_back];
+    }
+
+    /// Make the back slot the newest value and start on a fresh back slot
+    void publish()
+    {
+        _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & SLOT;
+    }
+
+    /// Pick up the newest published value if there is one, returns false if nothing changed
+    bool update()
+    {
+        if ((_middle.load(std::memory_order_relaxed) & FRESH) == 0)
+        {
+            return false;
+        }
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & SLOT;
+        return true;
+    }
+
+    /// Slot the consumer reads, valid until its next update()
+    const T &front() const
+    {
+        return _slots[_front];
+    }
+
+private:
+    /// The middle index carries a flag saying the producer published it since the consumer last looked
+    static const unsigned int SLOT = 3;
+    static const unsigned int FRESH = 4;
+
+    T _slots[3];
+
+    /// Only touched by the producer
+    unsigned int _back;
+
+    alignas(64) std::atomic<unsigned int> _middle;
+
+    /// Only touched by the consumer, kept off the producer's cache lines
+    alignas(64) unsigned int _front;
+};
+
+#endif
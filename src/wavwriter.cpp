@@ -0,0 +1,121 @@
+#include "wavwriter.h"
+
+namespace
+{
+    const unsigned int HEADER_SIZE = 44;
+
+    /// WAV is little endian whatever the host is
+    void put16(unsigned char *out, const uint32_t value)
+    {
+        out[0] = value;
+        out[1] = value >> 8;
+    }
+
+    void put32(unsigned char *out, const uint32_t value)
+    {
+        out[0] = value;
+        out[1] = value >> 8;
+        out[2] = value >> 16;
+        out[3] = value >> 24;
+    }
+
+    void header(unsigned char *out, const unsigned int sampleRate, const uint32_t dataSize)
+    {
+        const unsigned char riff[4] = {'R', 'I', 'F', 'F'};
+        const unsigned char wave[8] = {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '};
+        const unsigned char data[4] = {'d', 'a', 't', 'a'};
+
+        for (int i = 0; i < 4; ++i)
+        {
+            out[i] = riff[i];
+            out[36 + i] = data[i];
+        }
+        put32(out + 4, 36 + dataSize);
+        for (int i = 0; i < 8; ++i)
+        {
+            out[8 + i] = wave[i];
+        }
+
+        // PCM, one channel of 16-bit samples
+        put32(out + 16, 16);
+        put16(out + 20, 1);
+        put16(out + 22, 1);
+        put32(out + 24, sampleRate);
+        put32(out + 28, sampleRate * 2);
+        put16(out + 32, 2);
+        put16(out + 34, 16);
+        put32(out + 40, dataSize);
+    }
+}
+
+wavWriter::wavWriter()
+    : _file(nullptr), _sampleRate(0), _samples(0), _failed(false)
+{
+}
+
+wavWriter::~wavWriter()
+{
+    close();
+}
+
+bool wavWriter::open(const char *path, const unsigned int sampleRate)
+{
+    close();
+
+    _file = fopen(path, "wb");
+    if (_file == nullptr)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+    _sampleRate = sampleRate;
+    _samples = 0;
+
+    // Sizes are filled in by close()
+    unsigned char bytes[HEADER_SIZE];
+    header(bytes, sampleRate, 0);
+    _failed = fwrite(bytes, 1, HEADER_SIZE, _file) != HEADER_SIZE;
+    return !_failed;
+}
+
+void wavWriter::write(const int16_t *samples, const size_t count)
+{
+    if (_file == nullptr)
+    {
+        return;
+    }
+
+    unsigned char bytes[1024];
+    for (size_t done = 0; done < count;)
+    {
+        size_t size = 0;
+        for (; done < count && size < sizeof(bytes); ++done, size += 2)
+        {
+            put16(bytes + size, (uint16_t)samples[done]);
+        }
+        _failed |= fwrite(bytes, 1, size, _file) != size;
+    }
+    _samples += count;
+}
+
+bool wavWriter::close()
+{
+    if (_file == nullptr)
+    {
+        return !_failed;
+    }
+
+    // Sizes are 32-bit, which caps a file at a little over six hours of 44.1khz audio
+    const uint64_t dataSize = _samples * 2;
+    if (dataSize > 0xFFFFFFFFu - 36)
+    {
+        _failed = true;
+    }
+
+    unsigned char bytes[HEADER_SIZE];
+    header(bytes, _sampleRate, (uint32_t)dataSize);
+    _failed |= fseek(_file, 0, SEEK_SET) != 0 || fwrite(bytes, 1, HEADER_SIZE, _file) != HEADER_SIZE;
+    _failed |= fclose(_file) != 0;
+    _file = nullptr;
+    return !_failed;
+}
@@ -0,0 +1,31 @@
+/// Writes signed 16-bit mono samples to a WAV file
+/// The header is written with zero lengths on open() and filled in by close(), so samples can be
+/// streamed to disk as they are made.
+///
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+class wavWriter
+{
+public:
+    wavWriter();
+    ~wavWriter();
+
+    bool open(const char *path, const unsigned int sampleRate);
+    void write(const int16_t *samples, const size_t count);
+
+    /// Finish the header and close the file, returns false if anything could not be written
+    bool close();
+
+private:
+    FILE *_file;
+    unsigned int _sampleRate;
+    uint64_t _samples;
+    bool _failed;
+};
+
+#endif
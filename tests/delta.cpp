@@ -0,0 +1,82 @@
+/// Delta decoding check
+/// Deltas have to round trip, and a delta or frame stream that is cut short or points past the
+/// block it applies to has to be turned down without touching memory outside the block.
+///
+/// Usage: delta <scratch frame stream path>
+///
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "delta.h"
+#include "framestream.h"
+
+const size_t BLOCK_SIZE = 64;
+
+int failed = 0;
+
+void expect(const bool condition, const char *what)
+{
+    if (!condition)
+    {
+        printf("FAIL %s\n", what);
+        ++failed;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs("Usage: delta <scratch frame stream path>\n", stderr);
+        return 1;
+    }
+
+    unsigned char a[BLOCK_SIZE];
+    unsigned char b[BLOCK_SIZE];
+    for (size_t i = 0; i < BLOCK_SIZE; ++i)
+    {
+        a[i] = i;
+        b[i] = i % 5 == 0 ? i * 3 : i;
+    }
+
+    std::vector<unsigned char> encoded;
+    encodeDelta(a, b, BLOCK_SIZE, encoded);
+
+    // The block sits between two guards that must come out unchanged
+    unsigned char guarded[BLOCK_SIZE + 2];
+    guarded[0] = guarded[BLOCK_SIZE + 1] = 0xAA;
+    memcpy(&guarded[1], b, BLOCK_SIZE);
+    expect(applyDelta(encoded.data(), encoded.data() + encoded.size(), &guarded[1], BLOCK_SIZE), "a good delta is applied");
+    expect(memcmp(&guarded[1], a, BLOCK_SIZE) == 0, "a delta turns one block into the other");
+
+    // A zero run past the end, a literal run past the end, literals missing and a length cut short
+    const unsigned char BAD[][4] = {{BLOCK_SIZE + 1, 0}, {BLOCK_SIZE - 1, 2, 1, 1}, {0, 3, 1, 1}, {0x80}};
+    const size_t BAD_SIZES[] = {2, 4, 4, 1};
+    for (size_t i = 0; i < sizeof(BAD_SIZES) / sizeof(BAD_SIZES[0]); ++i)
+    {
+        memcpy(&guarded[1], a, BLOCK_SIZE);
+        expect(!applyDelta(BAD[i], BAD[i] + BAD_SIZES[i], &guarded[1], BLOCK_SIZE), "a bad delta is turned down");
+        expect(memcmp(&guarded[1], a, BLOCK_SIZE) == 0, "a bad delta leaves the block alone");
+    }
+    expect(guarded[0] == 0xAA && guarded[BLOCK_SIZE + 1] == 0xAA, "nothing outside the block is written");
+
+    // A frame stream whose second screen skips past the end of the screen
+    const unsigned char STREAM[] = {'C', '8', 'F', 'S', 1, 1, 1, 3, 0, 1, 0xFF, 1, 1, 4, 0xFF, 0x7F, 1, 1, 0, 0};
+    FILE *file = fopen(argv[1], "wb");
+    if (file == nullptr || fwrite(STREAM, 1, sizeof(STREAM), file) != sizeof(STREAM) || fclose(file) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", argv[1]);
+        return 1;
+    }
+
+    frameStream stream;
+    uint64_t frame;
+    uint64_t gfx[32];
+    expect(stream.open(argv[1]), "the stream opens");
+    expect(stream.next(frame, gfx) && frame == 1 && gfx[0] >> 56 == 0xFF, "the good screen is read");
+    expect(!stream.next(frame, gfx), "the bad screen ends the stream");
+
+    printf("%d checks failed\n", failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+/// Fork check
+/// A fork has to carry on exactly like the machine it was forked from, and neither may see the
+/// other's writes to the memory and decoded instructions they share.
+///
+/// Usage: fork <rom> ...
+///
+/// After catching up with the machine that was never forked, the child loads the next ROM with
+/// other quirks, which decodes everything again, before the parent has to catch up too.
+///
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include "chip8.h"
+
+/// Frames run before forking, then by each of the two machines after it
+/// Long enough after it for a JIT child to switch from the decode cache to a code cache of its own.
+const int BEFORE = 30;
+const int AFTER = 1000;
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs("Usage: fork <rom> ...\n", stderr);
+        return 1;
+    }
+
+    int failed = 0;
+    int checked = 0;
+    const char *NAMES[] = {"switch", "cache", "jit", "threaded", "aot"};
+    for (int rom = 1; rom < argc; ++rom)
+    {
+        for (const char *name : NAMES)
+        {
+            chip8::dispatch mode = chip8::dispatch::SWITCH;
+            parseDispatch(name, mode);
+
+            // What both machines should get to, run without forking
+            chip8 reference;
+            reference.init();
+            reference.setDispatch(mode);
+            chip8 parent;
+            parent.init();
+            parent.setDispatch(mode);
+            if (!reference.load(argv[rom]) || !parent.load(argv[rom]))
+            {
+                return 1;
+            }
+
+            for (int frame = 0; frame < BEFORE; ++frame)
+            {
+                reference.runFrame();
+                parent.runFrame();
+            }
+            std::unique_ptr<chip8> child = parent.fork();
+
+            // The child runs ahead first, so whatever it writes is there to leak into the parent
+            uint64_t expected[AFTER];
+            for (int frame = 0; frame < AFTER; ++frame)
+            {
+                reference.runFrame();
+                expected[frame] = reference.stateHash();
+            }
+
+            int childFrame = 0;
+            while (childFrame < AFTER && (child->runFrame(), child->stateHash() == expected[childFrame]))
+            {
+                ++childFrame;
+            }
+            child->setQuirks(quirks::VIP);
+            if (!child->load(argv[rom % (argc - 1) + 1]))
+            {
+                return 1;
+            }
+            for (int frame = 0; frame < AFTER; ++frame)
+            {
+                child->runFrame();
+            }
+
+            int parentFrame = 0;
+            while (parentFrame < AFTER && (parent.runFrame(), parent.stateHash() == expected[parentFrame]))
+            {
+                ++parentFrame;
+            }
+
+            if (childFrame < AFTER || parentFrame < AFTER)
+            {
+                printf("FAIL %s %s: the %s differs %d frames after the fork\n", argv[rom], name,
+                       childFrame < AFTER ? "child" : "parent", childFrame < AFTER ? childFrame : parentFrame);
+                ++failed;
+            }
+            ++checked;
+        }
+    }
+
+    printf("%d of %d forks failed\n", failed, checked);
+    return failed == 0 ? 0 : 1;
+}
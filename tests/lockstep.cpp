@@ -0,0 +1,131 @@
+/// Lockstep check
+/// Every lane of a lockstep engine has to end up exactly where a chip8 running the same program
+/// with the same seed and keys does, whether or not the lanes stay together.
+///
+/// Usage: lockstep <scratch rom path> <rom> ...
+///
+/// The scratch ROM waits for keys with FX0A. Only some lanes get keys, and at different times, so
+/// lanes wait while others run and the group run as vectors is not always the one lane 0 is in.
+/// Every ROM runs on the plain kernels and again on the AVX2 ones where the CPU has AVX2.
+///
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <vector>
+#include "chip8.h"
+#include "lockstep.h"
+
+/// Lanes asked for, rounded up by lockstep to whole vectors
+const unsigned int LANES = 40;
+
+const int STEPS = 3000;
+
+/// Steps per 60hz timer tick, close to the default instruction rate
+const int STEPS_PER_TICK = 12;
+
+/// Steps between comparisons, every lane hashes its whole memory
+const int CHECK_EVERY = 25;
+
+/// Set the delay timer, wait for a key, draw it, read the timer and wait for the next key
+const unsigned char WAIT_ROM[] = {0x60, 0x3C, 0xF0, 0x15, 0xF1, 0x0A, 0xF1, 0x29, 0xD0, 0x05, 0xF2, 0x07, 0x12, 0x04};
+
+/// A key pressed or released at a step in every lane whose number modulo every is 0
+struct keyChange
+{
+    int step;
+    unsigned int every;
+    bool pressed;
+};
+
+const keyChange KEYS[] = {{600, 3, true}, {700, 3, false}, {1500, 2, true}, {1510, 2, false}, {2200, 5, true}, {2201, 5, false}};
+
+/// Run one ROM both ways, false if a lane ever differs
+bool check(const char *path, const bool allowAvx2)
+{
+    lockstep lanes(LANES, allowAvx2);
+    if (allowAvx2 && !lanes.usesAvx2())
+    {
+        printf("SKIP %s: no AVX2 kernels on this CPU or build\n", path);
+        return true;
+    }
+    if (!lanes.load(path))
+    {
+        return false;
+    }
+
+    std::vector<std::unique_ptr<chip8>> machines;
+    for (unsigned int lane = 0; lane < lanes.lanes(); ++lane)
+    {
+        machines.emplace_back(new chip8());
+        machines[lane]->init();
+        if (!machines[lane]->load(path))
+        {
+            return false;
+        }
+        machines[lane]->seed(lane + 1);
+        lanes.seed(lane, lane + 1);
+    }
+
+    for (int step = 1; step <= STEPS; ++step)
+    {
+        for (const keyChange &change : KEYS)
+        {
+            for (unsigned int lane = 0; change.step == step && lane < lanes.lanes(); lane += change.every)
+            {
+                machines[lane]->setKey(lane & 0xF, change.pressed);
+                lanes.setKey(lane, lane & 0xF, change.pressed);
+            }
+        }
+
+        for (unsigned int lane = 0; lane < lanes.lanes(); ++lane)
+        {
+            machines[lane]->cycle();
+        }
+        lanes.step();
+
+        if (step % STEPS_PER_TICK == 0)
+        {
+            for (unsigned int lane = 0; lane < lanes.lanes(); ++lane)
+            {
+                machines[lane]->tickTimers();
+            }
+            lanes.tickTimers();
+        }
+
+        for (unsigned int lane = 0; step % CHECK_EVERY == 0 && lane < lanes.lanes(); ++lane)
+        {
+            if (lanes.stateHash(lane) != machines[lane]->stateHash())
+            {
+                printf("FAIL %s: lane %u differs after %d steps or fewer with the %s kernels\n", path, lane, step, lanes.usesAvx2() ? "AVX2" : "plain");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fputs("Usage: lockstep <scratch rom path> <rom> ...\n", stderr);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "wb");
+    if (file == nullptr || fwrite(WAIT_ROM, 1, sizeof(WAIT_ROM), file) != sizeof(WAIT_ROM) || fclose(file) != 0)
+    {
+        fprintf(stderr, "Could not write %s\n", argv[1]);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int rom = 1; rom < argc; ++rom)
+    {
+        failed += check(argv[rom], false) ? 0 : 1;
+        failed += check(argv[rom], true) ? 0 : 1;
+    }
+
+    printf("%d of %d runs failed\n", failed, 2 * (argc - 1));
+    return failed == 0 ? 0 : 1;
+}
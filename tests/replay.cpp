@@ -0,0 +1,134 @@
+/// Record and replay check for inputLog
+/// Records key presses while a ROM waits in FX0A, saves and loads the log, and replays it on a
+/// fresh machine with every dispatch mode. The replay has to match the recording frame for frame.
+/// Then logs with a short seed or a length that runs on past 64 bits have to be turned down.
+///
+/// Usage: replay <scratch log path>
+///
+#include <inttypes.h>
+#include <stdio.h>
+#include <vector>
+#include "chip8.h"
+#include "inputlog.h"
+
+const int FRAMES = 90;
+
+/// Delay timer = 60, wait for a key, then read the timer into V2 and loop
+/// A key pressed at frame 30 leaves V2 at 30 only if the key arrives 30 frames into the wait.
+const unsigned char WAIT_ROM[] = {0x60, 0x3C, 0xF0, 0x15, 0xF1, 0x0A, 0xF2, 0x07, 0x12, 0x08};
+
+struct keyChange
+{
+    int frame;
+    unsigned char key;
+    bool pressed;
+};
+
+const keyChange KEYS[] = {{30, 0x5, true}, {33, 0x5, false}, {50, 0xA, true}, {51, 0xA, false}};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs("Usage: replay <scratch log path>\n", stderr);
+        return 1;
+    }
+
+    // Record, keeping the state after every frame
+    chip8 recorder;
+    recorder.init();
+    recorder.load(WAIT_ROM, sizeof(WAIT_ROM));
+    inputLog log;
+    log.begin(recorder, 0x1234);
+
+    std::vector<uint64_t> recorded;
+    size_t next = 0;
+    for (int frame = 0; frame < FRAMES; ++frame)
+    {
+        while (next < sizeof(KEYS) / sizeof(KEYS[0]) && KEYS[next].frame == frame)
+        {
+            log.apply(recorder, KEYS[next].key, KEYS[next].pressed);
+            ++next;
+        }
+        recorder.runFrame();
+        recorded.push_back(recorder.stateHash());
+    }
+
+    if (!log.save(argv[1]))
+    {
+        return 1;
+    }
+
+    int failed = 0;
+    const char *NAMES[] = {"switch", "cache", "jit", "threaded", "aot"};
+    for (const char *name : NAMES)
+    {
+        chip8::dispatch mode = chip8::dispatch::SWITCH;
+        parseDispatch(name, mode);
+
+        inputLog loaded;
+        if (!loaded.load(argv[1]) || loaded.events().size() != log.events().size())
+        {
+            printf("FAIL %s: the log did not load back with %zu events\n", name, log.events().size());
+            ++failed;
+            continue;
+        }
+
+        chip8 player;
+        player.init();
+        player.setDispatch(mode);
+        player.load(WAIT_ROM, sizeof(WAIT_ROM));
+        loaded.rewind(player);
+        int frame = 0;
+        for (; frame < FRAMES; ++frame)
+        {
+            loaded.replay(player);
+            player.runFrame();
+            if (player.stateHash() != recorded[frame])
+            {
+                break;
+            }
+        }
+
+        if (frame < FRAMES)
+        {
+            printf("FAIL %s: frame %d differs from the recording\n", name, frame);
+            ++failed;
+        }
+        else if (!loaded.finished())
+        {
+            printf("FAIL %s: events left over after the replay\n", name);
+            ++failed;
+        }
+    }
+
+    // Written over the scratch log, after the replays are done with it
+    const unsigned char SHORT_SEED[] = {'C', '8', 'I', 'L', 2, 1, 2, 3};
+    const unsigned char LONG_LENGTH[] = {'C', '8', 'I', 'L', 2, 0, 0, 0, 0, 0, 0, 0, 0,
+                                         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0, 0x15};
+    const struct
+    {
+        const char *name;
+        const unsigned char *bytes;
+        size_t size;
+    } CORRUPT[] = {{"short seed", SHORT_SEED, sizeof(SHORT_SEED)}, {"long length", LONG_LENGTH, sizeof(LONG_LENGTH)}};
+    for (const auto &corrupt : CORRUPT)
+    {
+        FILE *file = fopen(argv[1], "wb");
+        if (file == nullptr || fwrite(corrupt.bytes, 1, corrupt.size, file) != corrupt.size || fclose(file) != 0)
+        {
+            fprintf(stderr, "Could not write %s\n", argv[1]);
+            return 1;
+        }
+
+        inputLog loaded;
+        if (loaded.load(argv[1]))
+        {
+            printf("FAIL a log with a %s loaded\n", corrupt.name);
+            ++failed;
+        }
+    }
+
+    printf("%d of %zu replays and corrupt logs failed\n", failed, sizeof(NAMES) / sizeof(NAMES[0]) + sizeof(CORRUPT) / sizeof(CORRUPT[0]));
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+/// Rewind check
+/// Stepping back through a rewindBuffer has to put the machine back exactly where it was on every
+/// recorded frame, and running on from there has to retrace the same frames.
+///
+/// Usage: rewind <rom> ...
+///
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "chip8.h"
+#include "rewindbuffer.h"
+
+const int FRAMES = 120;
+
+/// Big enough for every frame, and small enough that the oldest frames have to be dropped
+const size_t CAPACITIES[] = {1024 * 1024, 2048};
+
+/// What has to come back after stepping back to a frame
+struct mark
+{
+    uint64_t hash;
+    uint64_t instructions;
+    uint64_t frames;
+};
+
+mark markOf(const chip8 &machine)
+{
+    return {machine.stateHash(), machine.instructions(), machine.frames()};
+}
+
+bool operator!=(const mark &a, const mark &b)
+{
+    return a.hash != b.hash || a.instructions != b.instructions || a.frames != b.frames;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fputs("Usage: rewind <rom> ...\n", stderr);
+        return 1;
+    }
+
+    int failed = 0;
+    int checked = 0;
+    for (int rom = 1; rom < argc; ++rom)
+    {
+        for (const size_t capacity : CAPACITIES)
+        {
+            chip8 machine;
+            machine.init();
+            if (!machine.load(argv[rom]))
+            {
+                return 1;
+            }
+
+            rewindBuffer history(capacity);
+            std::vector<mark> marks;
+            for (int frame = 0; frame < FRAMES; ++frame)
+            {
+                machine.runFrame();
+                history.record(machine);
+                marks.push_back(markOf(machine));
+            }
+
+            // Back as far as the buffer goes, which is all the way only when nothing was dropped
+            const size_t available = history.frames();
+            size_t back = 0;
+            while (history.stepBack(machine))
+            {
+                ++back;
+                if (markOf(machine) != marks[FRAMES - 1 - back])
+                {
+                    break;
+                }
+            }
+
+            // Then forward again from the oldest frame left, through every frame stepped back over
+            size_t forward = 0;
+            if (back == available)
+            {
+                while (forward < available)
+                {
+                    machine.runFrame();
+                    if (markOf(machine) != marks[FRAMES - available + forward])
+                    {
+                        break;
+                    }
+                    ++forward;
+                }
+            }
+
+            // Everything but the newest frame is a step back when the buffer is big enough
+            if (back != available || forward != available || (capacity == CAPACITIES[0] && available != FRAMES - 1))
+            {
+                printf("FAIL %s with %zu bytes: %zu of %zu frames back, %zu forward\n", argv[rom], capacity, back, available, forward);
+                ++failed;
+            }
+            ++checked;
+        }
+    }
+
+    printf("%d of %d rewinds failed\n", failed, checked);
+    return failed == 0 ? 0 : 1;
+}